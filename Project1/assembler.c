@@ -0,0 +1,381 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../common/mips.h"
+
+/* Assembler for the disassembler's own output. Each line is one of
+ *
+ *   CS3339 MIPS Disassembler      (the banner, ignored)
+ *   label:                        (as printed by disassembler -s)
+ *     400010: addiu $sp, $fp, -56
+ *   addiu $sp, $fp, -56           (the address is optional)
+ *
+ * with '#' starting a comment. Operands are parsed by the instruction's
+ * mips_format, so anything the disassembler prints assembles back to an
+ * instruction that prints the same way. Jump and branch targets are hex
+ * addresses or labels; a name that could be either, like "beef", is the
+ * label if the input defines one. "unimplemented" assembles to a word with
+ * an opcode outside the ISA.
+ *
+ * Labels are resolved in a single pass: a reference to a label that is not
+ * yet defined is recorded in a fix-up list and patched once the whole input
+ * has been read. The output is a .mips file: the count and start address,
+ * then the instructions, all as big-endian words. */
+
+#define UNIMPLEMENTED 0xfc000000u  // opcode 0x3f
+
+static uint32_t *text;
+static int count, capacity;
+static uint32_t start;
+static int line;
+
+// Labels hold an instruction index, since a label can come before the
+// first address
+struct label {
+  char *name;
+  int index;
+};
+
+static struct label *label;  // open-addressed hash table
+static int labels, label_slots;
+
+struct fixup {
+  int index;  // instruction to patch
+  int line;   // for error messages
+  char *name;
+};
+
+static struct fixup *fixup;
+static int fixups, fixup_capacity;
+
+static void Error(const char *what)
+{
+  fprintf(stderr, "error: line %d: %s\n", line, what);
+  exit(-1);
+}
+
+static void *Grow(void *p, int *capacity, size_t size)
+{
+  *capacity = *capacity ? 2 * *capacity : 1024;
+  p = realloc(p, *capacity * size);
+  if (p == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  return p;
+}
+
+static unsigned Hash(const char *s)
+{
+  unsigned h = 2166136261u;
+
+  while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static struct label *FindLabel(const char *name)
+/* The slot holding name, or the empty slot where it would go */
+{
+  unsigned i = Hash(name) & (label_slots - 1);
+
+  while (label[i].name != NULL && strcmp(label[i].name, name) != 0)
+    i = (i + 1) & (label_slots - 1);
+  return &label[i];
+}
+
+static void DefineLabel(const char *name, int index)
+{
+  struct label *old = label, *l;
+  int c, n = label_slots;
+
+  if (2 * (labels + 1) > label_slots) {
+    label_slots = label_slots ? 2 * label_slots : 1024;
+    label = (struct label *)(calloc(label_slots, sizeof(*label)));
+    if (label == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+    for (c = 0; c < n; c++) {
+      if (old[c].name != NULL) *FindLabel(old[c].name) = old[c];
+    }
+    free(old);
+  }
+  l = FindLabel(name);
+  if (l->name != NULL) Error("label defined twice");
+  l->name = strdup(name);
+  l->index = index;
+  labels++;
+}
+
+static char *SkipSpace(char *p)
+{
+  while (*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+static char *Expect(char *p, char c)
+{
+  p = SkipSpace(p);
+  if (*p != c) Error(c == ',' ? "expected ','" : c == '(' ? "expected '('" : "expected ')'");
+  return p + 1;
+}
+
+static char *Register(char *p, unsigned *reg)
+/* $name or $number */
+{
+  char *end;
+  int c;
+
+  p = SkipSpace(p);
+  if (*p != '$') Error("expected a register");
+  for (c = 0; c < 32; c++) {
+    size_t n = mips_regname_len[c];
+    if (memcmp(p, mips_regname[c], n) == 0 && !isalnum((unsigned char)p[n])) {
+      *reg = c;
+      return p + n;
+    }
+  }
+  c = strtol(p + 1, &end, 10);
+  if (end == p + 1 || c < 0 || c > 31) Error("bad register");
+  *reg = c;
+  return end;
+}
+
+static char *Number(char *p, long *value, int base)
+{
+  char *end;
+
+  p = SkipSpace(p);
+  *value = strtol(p, &end, base);
+  if (end == p) Error("expected a number");
+  return end;
+}
+
+static char *Name(char *p, char *name, size_t size)
+/* A label: letters, digits, '_', '.' and '$' */
+{
+  size_t n = 0;
+
+  p = SkipSpace(p);
+  while (isalnum((unsigned char)*p) || *p == '_' || *p == '.' || *p == '$') {
+    if (n + 1 >= size) Error("label too long");
+    name[n++] = *p++;
+  }
+  name[n] = '\0';
+  if (n == 0) Error("expected a label or address");
+  return p;
+}
+
+static int IsHex(const char *s)
+{
+  if (*s == '\0') return 0;
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && s[2] != '\0') s += 2;
+  for (; *s; s++) {
+    if (!isxdigit((unsigned char)*s)) return 0;
+  }
+  return 1;
+}
+
+static uint32_t Patch(uint32_t word, uint32_t pc, uint32_t target)
+/* Fills in the target field of a jump or branch at pc */
+{
+  int32_t offset;
+
+  if ((word >> 26) == 2 || (word >> 26) == 3) {
+    if (((pc + 4) ^ target) & 0xf0000000) Error("jump target out of range");
+    if (target & 3) Error("misaligned jump target");
+    return (word & 0xfc000000) | ((target >> 2) & 0x3ffffff);
+  }
+  offset = (int32_t)(target - pc - 4);
+  if (offset & 3) Error("misaligned branch target");
+  offset >>= 2;
+  if (offset < -32768 || offset > 32767) Error("branch target out of range");
+  return (word & 0xffff0000) | (offset & 0xffff);
+}
+
+static char *Target(char *p, int index, uint32_t *word)
+/* A hex address, or a label that is resolved now or fixed up at the end */
+{
+  char name[256];
+  struct label *l;
+  uint32_t pc = start + 4 * index;
+
+  p = Name(p, name, sizeof(name));
+  l = label_slots ? FindLabel(name) : NULL;
+  if (l != NULL && l->name != NULL) {
+    *word = Patch(*word, pc, start + 4 * l->index);
+    return p;
+  }
+  // Leading digit: an address. Otherwise even all-hex names wait for the
+  // end, in case they are labels defined further down.
+  if (isdigit((unsigned char)name[0]) && IsHex(name)) {
+    *word = Patch(*word, pc, strtoul(name, NULL, 16));
+    return p;
+  }
+  if (fixups == fixup_capacity) fixup = (struct fixup *)(Grow(fixup, &fixup_capacity, sizeof(*fixup)));
+  fixup[fixups].index = index;
+  fixup[fixups].line = line;
+  fixup[fixups].name = strdup(name);
+  fixups++;
+  return p;
+}
+
+static uint32_t Assemble(char *p, int index)
+{
+  char name[16];
+  const struct mips_desc *d;
+  unsigned rs = 0, rt = 0, rd = 0;
+  long value = 0;
+  uint32_t word;
+  int op;
+
+  p = Name(p, name, sizeof(name));
+  for (op = 0; op < MIPS_OPS; op++) {
+    if (strcmp(name, mips_desc[op].mnemonic) == 0) break;
+  }
+  if (op == MIPS_OPS) Error("unknown instruction");
+  if (op == MIPS_INVALID) return UNIMPLEMENTED;
+  d = &mips_desc[op];
+  word = (uint32_t)d->opcode << 26 | d->funct;
+  if (d->opcode != 0) word &= 0xfc000000;
+
+  switch (d->format) {
+    case MIPS_FMT_R3:
+      p = Register(p, &rd);
+      p = Register(Expect(p, ','), &rs);
+      p = Register(Expect(p, ','), &rt);
+      break;
+    case MIPS_FMT_SHIFT:
+      p = Register(p, &rd);
+      p = Register(Expect(p, ','), &rs);
+      p = Number(Expect(p, ','), &value, 10);
+      if (value < 0 || value > 31) Error("shift amount out of range");
+      word |= value << 6;
+      break;
+    case MIPS_FMT_RS:
+      p = Register(p, &rs);
+      break;
+    case MIPS_FMT_RD:
+      p = Register(p, &rd);
+      break;
+    case MIPS_FMT_RSRT:
+      p = Register(p, &rs);
+      p = Register(Expect(p, ','), &rt);
+      break;
+    case MIPS_FMT_JUMP:
+      p = Target(p, index, &word);
+      break;
+    case MIPS_FMT_BRANCH:
+      p = Register(p, &rs);
+      p = Register(Expect(p, ','), &rt);
+      p = Target(Expect(p, ','), index, &word);
+      break;
+    case MIPS_FMT_SIMM:
+    case MIPS_FMT_UIMM:
+      p = Register(p, &rt);
+      p = Register(Expect(p, ','), &rs);
+      p = Number(Expect(p, ','), &value, 10);
+      if (d->format == MIPS_FMT_SIMM ? value < -32768 || value > 32767 : value < 0 || value > 65535) Error("immediate out of range");
+      word |= value & 0xffff;
+      break;
+    case MIPS_FMT_UPPER:
+      p = Register(p, &rt);
+      p = Number(Expect(p, ','), &value, 10);
+      if (value < -32768 || value > 65535) Error("immediate out of range");
+      word |= value & 0xffff;
+      break;
+    case MIPS_FMT_CODE:
+      p = Number(p, &value, 16);
+      if (value < 0 || value > 0x3ffffff) Error("code out of range");
+      word |= value;
+      break;
+    case MIPS_FMT_MEM:
+      p = Register(p, &rt);
+      p = Number(Expect(p, ','), &value, 10);
+      if (value < -32768 || value > 32767) Error("offset out of range");
+      word |= value & 0xffff;
+      p = Register(Expect(p, '('), &rs);
+      p = Expect(p, ')');
+      break;
+  }
+  p = SkipSpace(p);
+  if (*p != '\0') Error("junk after instruction");
+  return word | rs << 21 | rt << 16 | rd << 11;
+}
+
+static void Line(char *p)
+{
+  char *colon, *q;
+
+  if ((q = strchr(p, '#')) != NULL) *q = '\0';
+  for (q = p + strlen(p); q > p && isspace((unsigned char)q[-1]); q--) ;
+  *q = '\0';
+  p = SkipSpace(p);
+  if (*p == '\0' || strcmp(p, "CS3339 MIPS Disassembler") == 0) return;
+
+  colon = strchr(p, ':');
+  if (colon != NULL) {
+    *colon = '\0';
+    for (q = colon; q > p && isspace((unsigned char)q[-1]); ) *--q = '\0';
+    if (*SkipSpace(colon + 1) == '\0') {
+      // label:
+      DefineLabel(p, count);
+      return;
+    }
+    // address: instruction
+    if (!IsHex(p)) Error("bad address");
+    if (count == 0) start = strtoul(p, NULL, 16);
+    else if (strtoul(p, NULL, 16) != start + 4 * count) Error("addresses are not consecutive");
+    p = colon + 1;
+  }
+  if (count == capacity) text = (uint32_t *)(Grow(text, &capacity, sizeof(*text)));
+  text[count] = Assemble(p, count);
+  count++;
+}
+
+static void Put(FILE *f, uint32_t word)
+{
+  unsigned char b[4] = {word >> 24, word >> 16, word >> 8, word};
+
+  if (fwrite(b, 1, 4, f) != 4) {fprintf(stderr, "error: could not write output\n"); exit(-1);}
+}
+
+int main(int argc, char *argv[])
+{
+  char buf[1024];
+  FILE *in, *out;
+  struct label *l;
+  uint32_t target;
+  int c;
+
+  if (argc != 3) {fprintf(stderr, "usage: %s input.s|- output.mips\n", argv[0]); exit(-1);}
+  in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+  if (in == NULL) {fprintf(stderr, "error: could not open file %s\n", argv[1]); exit(-1);}
+
+  // Until an address says otherwise, text starts where the simulators load it
+  start = 0x00400000;
+  while (fgets(buf, sizeof(buf), in) != NULL) {
+    line++;
+    if (strchr(buf, '\n') == NULL && !feof(in)) Error("line too long");
+    Line(buf);
+  }
+  if (ferror(in)) {fprintf(stderr, "error: could not read file %s\n", argv[1]); exit(-1);}
+
+  for (c = 0; c < fixups; c++) {
+    line = fixup[c].line;
+    l = label_slots ? FindLabel(fixup[c].name) : NULL;
+    if (l != NULL && l->name != NULL) target = start + 4 * l->index;
+    else if (IsHex(fixup[c].name)) target = strtoul(fixup[c].name, NULL, 16);
+    else Error("undefined label");
+    text[fixup[c].index] = Patch(text[fixup[c].index], start + 4 * fixup[c].index, target);
+  }
+
+  out = fopen(argv[2], "wb");
+  if (out == NULL) {fprintf(stderr, "error: could not open file %s\n", argv[2]); exit(-1);}
+  Put(out, count);
+  Put(out, start);
+  for (c = 0; c < count; c++) {
+    Put(out, text[c]);
+  }
+  if (fclose(out) != 0) {fprintf(stderr, "error: could not write output\n"); exit(-1);}
+  return 0;
+}
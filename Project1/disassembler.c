@@ -1,118 +1,522 @@
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-const char reg[32][6] = {"$zero","$at","$v0","$v1","$a0","$a1","$a2","$a3",
-  "$t0","$t1","$t2","$t3","$t4","$t5","$t6","$t7","$s0","$s1","$s2","$s3",
-  "$s4","$s5","$s6","$s7","$t8","$t9","$k0","$k1","$gp","$sp","$fp","$ra"};
-
-static void Decode(int pc, int instr)  // do not make any changes outside of this function
-{
-  #ifndef CHAR_BIT
-  # define CHAR_BIT 8
-  #endif
-
-  // Reinterpret the bit sequence defined by [low, high) on `instr'
-  #define BITRANGE(value, low, high) (((value) >> low) & ((1 << (high - low)) - 1))
-  #define SIGN_EXTEND(value, bits) (((signed int) (value) << (sizeof (int) * CHAR_BIT - bits)) >> (sizeof (int) * CHAR_BIT - bits))
-
-  unsigned int opcode = BITRANGE (instr, 26, 32);
-  unsigned int rs     = BITRANGE (instr, 21, 26);
-  unsigned int rt     = BITRANGE (instr, 16, 21);
-  unsigned int rd     = BITRANGE (instr, 11, 16);
-  unsigned int shamt  = BITRANGE (instr, 6, 11);
-  unsigned int funct  = BITRANGE (instr, 0, 6);
-  unsigned int imm    = BITRANGE (instr, 0, 16);
-  signed   int simm   = SIGN_EXTEND (imm, 16);
-  unsigned int addr   = BITRANGE (instr, 0, 26);
-  unsigned int jaddr  = ((pc + 4) & 0xf0000000) + (addr << 2); // Jump address, adjusted for printing
-  unsigned int baddr  = pc + (simm << 2) + 4; // Branch address, adjusted for printing
-
-  #undef SIGN_EXTEND
-  #undef BITRANGE
-
-  const char* RD = reg [rd];
-  const char* RS = reg [rs];
-  const char* RT = reg [rt];
-
-  #define PRINT(format, ...) (printf ("%8x: "format"\n", pc, ##__VA_ARGS__))
-
-  switch (opcode) {
-    case 0x00:
-      switch (funct) {
-        //   FUNCTION     FORMAT           NAME    ARGUMENTS
-        case 0x00: PRINT ("%s %s, %s, %u", "sll",  RD, RS, shamt); break;
-        case 0x03: PRINT ("%s %s, %s, %u", "sra",  RD, RS, shamt); break;
-        case 0x08: PRINT ("%s %s",         "jr",   RS);            break;
-        case 0x10: PRINT ("%s %s",         "mfhi", RD);            break;
-        case 0x12: PRINT ("%s %s",         "mflo", RD);            break;
-        case 0x18: PRINT ("%s %s, %s",     "mult", RS, RT);        break;
-        case 0x1a: PRINT ("%s %s, %s",     "div",  RS, RT);        break;
-        case 0x21: PRINT ("%s %s, %s, %s", "addu", RD, RS, RT);    break;
-        case 0x23: PRINT ("%s %s, %s, %s", "subu", RD, RS, RT);    break;
-        case 0x2a: PRINT ("%s %s, %s, %s", "slt",  RD, RS, RT);    break;
-        default:   PRINT ("unimplemented");
-      }
+#include "../common/mips.h"
+#include "../common/mips_batch.h"
+#include "../common/mips_iter.h"
+
+static int little_endian;
+
+static int Convert(unsigned int x)
+{
+  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+// Instruction words are used in file (big-endian) order and converted as read
+#define WORD(w) (little_endian ? Convert(w) : (w))
+
+static struct mips_program prog;  // the mapped executable, unless streaming
+
+// Output formats (-F): disassembly text, JSON lines, or struct mips_record
+enum {TEXT, JSON, BINARY};
+static int format = TEXT;
+
+/* Symbolic mode (-s). A first pass over the text marks every branch and jump
+ * target in one bitmap and every jal target (and the entry point) in another,
+ * one bit per instruction, so it is linear in the size of the program. The
+ * second pass puts a func_ or L_ label line in front of each marked
+ * instruction and prints in-text targets by name. */
+static int symbolic, text_start, text_count;
+static unsigned char *target_bits, *func_bits;
+
+/* A label index (--labels file) saves both bitmaps, so that a later run can
+ * label a window of the program, or a stream, without the first pass. The
+ * file is a LABELS_MAGIC header with the text's count and start, followed by
+ * the target bitmap and then the function bitmap. An index that does not
+ * match the program is rebuilt; anything without the magic is left alone. */
+#define LABELS_MAGIC "MIPSLBL1"
+static const char *labels;
+
+#define BIT(map, i) ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define SETBIT(map, i) ((map)[(i) >> 3] |= 1 << ((i) & 7))
+
+/* Windows (--range, --around). Addresses map straight to instruction indices,
+ * (pc - start) / 4, so only the instructions in [first, last) are touched.
+ * The window is kept as addresses until the header gives the text start. */
+static uint32_t first, last;
+static uint64_t range_lo, range_hi = UINT64_MAX;
+
+static uint32_t Index(uint64_t pc, uint32_t start, uint32_t count)
+/* Index of the first instruction at or after pc, clamped to [0, count] */
+{
+  uint64_t i = pc <= start ? 0 : (pc - start + 3) / 4;
+
+  return i < count ? (uint32_t)i : count;
+}
+
+// Longest output for one instruction: a label line and the instruction line,
+// or a line of JSON
+#define OUT_LINE_MAX (2 * MIPS_LINE_MAX > MIPS_JSON_MAX ? 2 * MIPS_LINE_MAX : MIPS_JSON_MAX)
+
+static void Mark(const struct mips_insn *in)
+{
+  unsigned i = (in->target - text_start) / 4;
+
+  switch (in->op) {
+    case MIPS_J: case MIPS_JAL: case MIPS_BEQ: case MIPS_BNE:
+      if (in->target % 4 != (unsigned)text_start % 4 || i >= (unsigned)text_count) break;
+      SETBIT(target_bits, i);
+      if (in->op == MIPS_JAL) SETBIT(func_bits, i);
       break;
-    //   OPCODE       FORMAT           NAME     ARGUMENTS
-    case 0x02: PRINT ("%s %x",         "j",     jaddr);         break;
-    case 0x03: PRINT ("%s %x",         "jal",   jaddr);         break;
-    case 0x04: PRINT ("%s %s, %s, %x", "beq",   RS, RT, baddr); break;
-    case 0x05: PRINT ("%s %s, %s, %x", "bne",   RS, RT, baddr); break;
-    case 0x09: PRINT ("%s %s, %s, %d", "addiu", RT, RS, simm);  break;
-    case 0x0c: PRINT ("%s %s, %s, %u", "andi",  RT, RS, imm);   break;
-    // We should be using unsigned here per the MIPS spec, but we need signed to pass the testcases.
-    case 0x0f: PRINT ("%s %s, %d",     "lui",   RT, simm);      break;
-    case 0x1a: PRINT ("%s %x",         "trap",  addr);          break;
-    case 0x23: PRINT ("%s %s, %d(%s)", "lw",    RT, simm, RS);  break;
-    case 0x2b: PRINT ("%s %s, %d(%s)", "sw",    RT, simm, RS);  break;
-    default:   PRINT ("unimplemented");
   }
+}
 
-  #undef PRINT
+static void FindTargets(int start, int count)
+{
+  struct mips_batch b;
+  struct mips_insn in;
+  uint32_t words[8];
+  int c, i;
+
+  text_start = start;
+  text_count = count;
+  target_bits = (unsigned char *)(calloc((count + 7) / 8, 1));
+  func_bits = (unsigned char *)(calloc((count + 7) / 8, 1));
+  if (target_bits == NULL || func_bits == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+
+  SETBIT(func_bits, 0);
+  for (c = 0; c + 8 <= count; c += 8) {
+    for (i = 0; i < 8; i++) {
+      words[i] = mips_word(prog.text, c + i);
+    }
+    mips_decode8(&b, words, start + c * 4);
+    for (i = 0; i < 8; i++) {
+      if (b.op[i] == MIPS_J || b.op[i] == MIPS_JAL || b.op[i] == MIPS_BEQ || b.op[i] == MIPS_BNE) {
+        in = mips_batch_insn(&b, i);
+        Mark(&in);
+      }
+    }
+  }
+  for (; c < count; c++) {
+    in = mips_decode(mips_word(prog.text, c), start + c * 4);
+    Mark(&in);
+  }
 }
 
-static int Convert(unsigned int x)
+static int LoadLabels(const char *name, int start, int count)
 {
-  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+  char magic[8];
+  int header[2];
+  size_t n = (count + 7) / 8;
+  FILE *f = fopen(name, "rb");
+
+  if (f == NULL) return -1;
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, LABELS_MAGIC, 8) != 0) {fprintf(stderr, "error: %s is not a label index\n", name); exit(-1);}
+  target_bits = (unsigned char *)(malloc(n));
+  func_bits = (unsigned char *)(malloc(n));
+  if (target_bits == NULL || func_bits == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  if (fread(header, 4, 2, f) != 2 || header[0] != count || header[1] != start ||
+      fread(target_bits, 1, n, f) != n || fread(func_bits, 1, n, f) != n || fgetc(f) != EOF) {
+    fclose(f);
+    free(target_bits);
+    free(func_bits);
+    return -1;
+  }
+  fclose(f);
+  text_start = start;
+  text_count = count;
+  return 0;
+}
+
+static void SaveLabels(const char *name)
+{
+  int header[2] = {text_count, text_start};
+  size_t n = (text_count + 7) / 8;
+  FILE *f = fopen(name, "wb");
+
+  if (f == NULL || fwrite(LABELS_MAGIC, 1, 8, f) != 8 || fwrite(header, 4, 2, f) != 2 ||
+      fwrite(target_bits, 1, n, f) != n || fwrite(func_bits, 1, n, f) != n || fclose(f) != 0) {
+    fprintf(stderr, "error: could not write label index %s\n", name);
+    exit(-1);
+  }
+}
+
+static char *PutLabel(char *p, uint32_t pc)
+{
+  unsigned i = (pc - text_start) / 4;
+
+  if (BIT(func_bits, i)) {
+    memcpy(p, "func_", 5);
+    p += 5;
+  } else {
+    memcpy(p, "L_", 2);
+    p += 2;
+  }
+  return mips_put_hex(p, pc, 0);
+}
+
+static char *Emit(char *p, const struct mips_insn *in)
+{
+  unsigned i = (in->pc - text_start) / 4;
+  char *q;
+
+  struct mips_record r;
+
+  if (format == JSON) return mips_emit_json(p, in);
+  if (format == BINARY) {
+    r = mips_record(in);
+    memcpy(p, &r, sizeof(r));
+    return p + sizeof(r);
+  }
+  if (!symbolic) return mips_emit(p, in);
+
+  if (BIT(target_bits, i) || BIT(func_bits, i)) {
+    p = PutLabel(p, in->pc);
+    *p++ = ':';
+    *p++ = '\n';
+  }
+  p = mips_emit(p, in);
+
+  // Jump and branch targets come last on the line; swap in the label
+  i = (in->target - text_start) / 4;
+  if ((in->op == MIPS_J || in->op == MIPS_JAL || in->op == MIPS_BEQ || in->op == MIPS_BNE) &&
+      i < (unsigned)text_count && in->target % 4 == (unsigned)text_start % 4) {
+    for (q = p - 1; q[-1] != ' '; q--) ;
+    p = PutLabel(q, in->target);
+    *p++ = '\n';
+  }
+  return p;
+}
+
+/* Lines are formatted straight into a large buffer by mips_emit and written
+ * with one fwrite per buffer, which keeps stdio and format-string parsing out
+ * of the per-instruction path. */
+static char out[1 << 20];
+static size_t outlen;
+
+static void Flush(void)
+{
+  if (fwrite(out, 1, outlen, stdout) != outlen) {fprintf(stderr, "error: could not write output\n"); exit(-1);}
+  outlen = 0;
+}
+
+static void Decode(int pc, int instr)
+{
+  struct mips_insn in = mips_decode(instr, pc);
+
+  if (outlen > sizeof(out) - OUT_LINE_MAX) Flush();
+  outlen = Emit(out + outlen, &in) - out;
+}
+
+/* Parallel mode (-j). The instructions are cut into chunks of CHUNK; worker
+ * threads take chunks in order and format each into one of SLOTS buffers, and
+ * the main thread writes the buffers out in address order, gathering every
+ * consecutive finished chunk into one writev. A worker only starts a chunk
+ * once its slot has been written, so memory stays at SLOTS buffers, or one
+ * per chunk when there are fewer, each sized for the chunk. */
+#define CHUNK 16384
+#define SLOTS 64
+#define IOV_MAX_BATCH 16
+
+struct slot {
+  char *buf;
+  size_t len;
+  int ready;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct slot slot[SLOTS];
+  int slots;    // in use, at most SLOTS
+  int next;     // next chunk to hand out
+  int written;  // chunks written so far
+  int chunks;
+} par = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static void *Worker(void *arg)
+{
+  int chunk;
+  struct slot *s;
+  char *p;
+  struct mips_iter it;
+  struct mips_insn in;
+
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&par.lock);
+    while (par.next < par.chunks && par.next >= par.written + par.slots)
+      pthread_cond_wait(&par.cond, &par.lock);
+    chunk = par.next++;
+    pthread_mutex_unlock(&par.lock);
+    if (chunk >= par.chunks) return NULL;
+
+    s = &par.slot[chunk % par.slots];
+    p = s->buf;
+    mips_iter_init(&it, &prog, first + chunk * CHUNK, first + chunk * CHUNK + CHUNK < last ? first + chunk * CHUNK + CHUNK : last);
+    while (mips_iter_next(&it, &in)) {
+      p = Emit(p, &in);
+    }
+
+    pthread_mutex_lock(&par.lock);
+    s->len = p - s->buf;
+    s->ready = 1;
+    pthread_cond_broadcast(&par.cond);
+    pthread_mutex_unlock(&par.lock);
+  }
+}
+
+static void WriteAll(struct iovec *iov, int n)
+{
+  ssize_t w;
+
+  while (n > 0) {
+    w = writev(STDOUT_FILENO, iov, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "error: could not write output\n");
+      exit(-1);
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
+static void Parallel(int threads)
+{
+  pthread_t tid[threads];
+  struct iovec iov[IOV_MAX_BATCH];
+  size_t words = last - first < CHUNK ? last - first : CHUNK;
+  int c, n;
+
+  par.chunks = (last - first + CHUNK - 1) / CHUNK;
+  par.slots = par.chunks < SLOTS ? par.chunks : SLOTS;
+  for (c = 0; c < par.slots; c++) {
+    par.slot[c].buf = (char *)(malloc(words * OUT_LINE_MAX));
+    if (par.slot[c].buf == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  for (c = 0; c < threads; c++) {
+    if (pthread_create(&tid[c], NULL, Worker, NULL) != 0) {fprintf(stderr, "error: could not start thread\n"); exit(-1);}
+  }
+
+  fflush(stdout);
+  while (par.written < par.chunks) {
+    pthread_mutex_lock(&par.lock);
+    while (!par.slot[par.written % par.slots].ready)
+      pthread_cond_wait(&par.cond, &par.lock);
+    for (n = 0; n < IOV_MAX_BATCH && par.written + n < par.chunks; n++) {
+      struct slot *s = &par.slot[(par.written + n) % par.slots];
+      if (!s->ready) break;
+      iov[n].iov_base = s->buf;
+      iov[n].iov_len = s->len;
+    }
+    pthread_mutex_unlock(&par.lock);
+
+    WriteAll(iov, n);
+
+    pthread_mutex_lock(&par.lock);
+    for (c = 0; c < n; c++) {
+      par.slot[(par.written + c) % par.slots].ready = 0;
+    }
+    par.written += n;
+    pthread_cond_broadcast(&par.cond);
+    pthread_mutex_unlock(&par.lock);
+  }
+
+  for (c = 0; c < threads; c++) {
+    pthread_join(tid[c], NULL);
+  }
+  for (c = 0; c < par.slots; c++) {
+    free(par.slot[c].buf);
+  }
+}
+
+/* Streaming. A regular file is mapped and disassembled in place, BLOCK words
+ * at a time, dropping each block from memory once it has been formatted.
+ * Anything else (a pipe, or "-" for stdin) is read BLOCK words at a time, and
+ * the output is flushed after every read so that lines appear as soon as
+ * their instructions arrive. Either way, memory use does not depend on the
+ * size of the program. */
+#define BLOCK 65536
+
+static void Stream(int fd, const char *name, int start, int count)
+{
+  static int buf[BLOCK];
+  size_t have = 0;
+  ssize_t r;
+  int c, n, done = 0;
+
+  while (done < count && (uint32_t)done < last) {
+    r = read(fd, (char *)buf + have, sizeof(buf) - have);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {fprintf(stderr, "error: could not read instructions from file %s\n", name); exit(-1);}
+    have += r;
+    n = have / 4;
+    if (n > count - done) n = count - done;
+    for (c = 0; c < n; c++) {
+      if ((uint32_t)(done + c) >= first && (uint32_t)(done + c) < last) Decode(start + (done + c) * 4, WORD(buf[c]));
+    }
+    Flush();
+    fflush(stdout);
+    done += n;
+    have -= n * 4;
+    memmove(buf, (char *)buf + n * 4, have);
+  }
+}
+
+static void Mapped(void)
+{
+  uintptr_t page = sysconf(_SC_PAGESIZE), from, to;
+  uint32_t c;
+  struct mips_iter it;
+  struct mips_insn in;
+
+  for (c = first; c < last; c += BLOCK) {
+    mips_iter_init(&it, &prog, c, c + BLOCK < last ? c + BLOCK : last);
+    from = (uintptr_t)(prog.text + 4 * (size_t)c) & ~(page - 1);
+    while (mips_iter_next(&it, &in)) {
+      if (outlen > sizeof(out) - OUT_LINE_MAX) Flush();
+      outlen = Emit(out + outlen, &in) - out;
+    }
+    to = (uintptr_t)(prog.text + 4 * (size_t)it.end) & ~(page - 1);
+    if (to > from) madvise((void *)from, to - from, MADV_DONTNEED);
+  }
+  Flush();
+}
+
+static int ReadHeader(int fd, int *header)
+{
+  size_t have = 0;
+  ssize_t r;
+
+  while (have < 8) {
+    r = read(fd, (char *)header + have, 8 - have);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return have / 4;
+    have += r;
+  }
+  return 2;
 }
 
 int main(int argc, char *argv[])
 {
-  int c, count, start, little_endian, *instruction;
-  FILE *f;
+  int c, fd, count, start, header[2], threads = 1, context = 16;
+  uint64_t around = UINT64_MAX;
+  char *end;
+  struct stat st;
+  const char *usage = "usage: %s [-s] [-j threads] [-F text|json|binary] [--range start:end | --around addr [-C n]] [--labels file] mips_executable|-\n";
+  static const struct option options[] = {
+    {"range", required_argument, NULL, 'r'},
+    {"around", required_argument, NULL, 'a'},
+    {"context", required_argument, NULL, 'C'},
+    {"labels", required_argument, NULL, 'l'},
+    {NULL, 0, NULL, 0}
+  };
 
-  printf("CS3339 MIPS Disassembler\n");
-  if (argc != 2) {fprintf(stderr, "usage: %s mips_executable\n", argv[0]); exit(-1);}
+  while ((c = getopt_long(argc, argv, "j:sF:C:", options, NULL)) != -1) {
+    switch (c) {
+      case 's':
+        symbolic = 1;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        if (threads < 1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) threads = 1;
+        break;
+      case 'F':
+        if (strcmp(optarg, "text") == 0) format = TEXT;
+        else if (strcmp(optarg, "json") == 0) format = JSON;
+        else if (strcmp(optarg, "binary") == 0) format = BINARY;
+        else {fprintf(stderr, usage, argv[0]); exit(-1);}
+        break;
+      case 'r':
+        // Hex addresses as printed, end exclusive; either may be left out
+        end = optarg;
+        range_lo = *end == ':' ? 0 : strtoull(optarg, &end, 16);
+        if (*end++ != ':') {fprintf(stderr, usage, argv[0]); exit(-1);}
+        range_hi = *end == '\0' ? UINT64_MAX : strtoull(end, &end, 16);
+        if (*end != '\0') {fprintf(stderr, usage, argv[0]); exit(-1);}
+        break;
+      case 'a':
+        around = strtoull(optarg, &end, 16);
+        if (*end != '\0') {fprintf(stderr, usage, argv[0]); exit(-1);}
+        break;
+      case 'C':
+        context = atoi(optarg);
+        if (context < 0) {fprintf(stderr, usage, argv[0]); exit(-1);}
+        break;
+      case 'l':
+        labels = optarg;
+        break;
+      default:
+        fprintf(stderr, usage, argv[0]);
+        exit(-1);
+    }
+  }
+  if (around != UINT64_MAX) {
+    range_lo = around < 4 * (uint64_t)context ? 0 : around - 4 * (uint64_t)context;
+    range_hi = around + 4 * (uint64_t)context + 4;
+  }
+  // The banner would corrupt machine-readable output
+  if (format == TEXT) printf("CS3339 MIPS Disassembler\n");
+  if (argc - optind != 1) {fprintf(stderr, usage, argv[0]); exit(-1);}
+  argv += optind - 1;
   if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
 
   count = 1;
   little_endian = *((char *)&count);
 
-  f = fopen(argv[1], "r+b");
-  if (f == NULL) {fprintf(stderr, "error: could not open file %s\n", argv[1]); exit(-1);}
-  c = fread(&count, 4, 1, f);
-  if (c != 1) {fprintf(stderr, "error: could not read count from file %s\n", argv[1]); exit(-1);}
-  if (little_endian) {
-    count = Convert(count);
-  }
-  c = fread(&start, 4, 1, f);
-  if (c != 1) {fprintf(stderr, "error: could not read start from file %s\n", argv[1]); exit(-1);}
-  if (little_endian) {
-    start = Convert(start);
-  }
+  fd = strcmp(argv[1], "-") == 0 ? STDIN_FILENO : open(argv[1], O_RDONLY);
+  if (fd < 0) {fprintf(stderr, "error: could not open file %s\n", argv[1]); exit(-1);}
 
-  instruction = (int *)(malloc(count * 4));
-  if (instruction == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
-  c = fread(instruction, 4, count, f);
-  if (c != count) {fprintf(stderr, "error: could not read instructions from file %s\n", argv[1]); exit(-1);}
-  fclose(f);
-  if (little_endian) {
-    for (c = 0; c < count; c++) {
-      instruction[c] = Convert(instruction[c]);
-    }
+  if (mips_map(&prog, fd) != 0) {
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= 8) {fprintf(stderr, "error: could not read instructions from file %s\n", argv[1]); exit(-1);}
+    c = ReadHeader(fd, header);
+    if (c < 1) {fprintf(stderr, "error: could not read count from file %s\n", argv[1]); exit(-1);}
+    if (c < 2) {fprintf(stderr, "error: could not read start from file %s\n", argv[1]); exit(-1);}
+    count = WORD(header[0]);
+    start = WORD(header[1]);
+    // Without the whole text up front, labels can only come from an index
+    if (symbolic && count != 0 && (labels == NULL || LoadLabels(labels, start, count) != 0)) {fprintf(stderr, "error: symbolic mode needs a regular file or a label index\n"); exit(-1);}
+    first = Index(range_lo, start, count);
+    last = Index(range_hi, start, count);
+    Stream(fd, argv[1], start, count);
+    return 0;
+  }
+  close(fd);
+  count = prog.count;
+  start = prog.start;
+  first = Index(range_lo, start, count);
+  last = Index(range_hi, start, count);
+  if (first == 0 && last == prog.count) madvise(prog.map, prog.size, MADV_SEQUENTIAL);
+  if (symbolic && (labels == NULL || LoadLabels(labels, start, count) != 0)) {
+    FindTargets(start, count);
+    if (labels != NULL) SaveLabels(labels);
   }
 
-  for (c = 0; c < count; c++) {
-    Decode(start + c * 4, instruction[c]);
+  if (threads > 1) {
+    Parallel(threads);
+    return 0;
   }
+  Mapped();
+  return 0;
 }
@@ -0,0 +1,12 @@
+# Labels made only of hex digits are names, not addresses
+  j beef
+add:
+  addiu $t0, $t0, 1
+  bne $t0, $t1, add
+cafe:
+  beq $zero, $zero, f00
+beef:
+  addiu $t1, $zero, 3
+  j add
+f00:
+  jr $ra
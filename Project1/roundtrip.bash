@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Assembles each disassembly and checks that it disassembles back to itself
+
+tmp=$(mktemp)
+trap 'rm -f $tmp' EXIT
+
+for f in test{0..9}.dis ../Project4/sssp.s; do
+        echo "$f: "
+        ./assembler $f $tmp && ./disassembler $tmp | diff -w - $f
+done
+
+# Labels that are also hex numbers
+echo "hexlabels.s: "
+./assembler hexlabels.s $tmp && ./disassembler $tmp | diff -w - hexlabels.dis
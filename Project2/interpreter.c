@@ -2,25 +2,64 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../common/mips.h"
 
 #define MEMSIZE 1048576
+#define PAGESIZE 4096
+#define PAGES (MEMSIZE / PAGESIZE)
+#define HEAPBASE 0x10040000  // sbrk grows from here towards $sp
 
 static int little_endian, icount, *instruction;
+static struct mips_insn *decoded;
 static int mem[MEMSIZE / 4];
+static unsigned char dirty[PAGES];  // pages stored to since the last checkpoint
+
+/* Unified address space (-u). Guest memory is a table of 4 KiB pages over
+ * the whole 32-bit space: the text pages hold a copy of instruction[] and the
+ * data pages alias mem[]. Decoded records are kept per page in xlat[], built
+ * the first time a page is executed, and has_xlat has one bit per page so a
+ * store only pays for re-decoding when it lands in a page that has been
+ * executed. */
+#define UPAGES (1 << 20)
+
+static int unified;
+static int *upage[UPAGES];
+static struct mips_insn *xlat[UPAGES];
+static unsigned char has_xlat[UPAGES / 8];
 
 static int Convert(unsigned int x)
 {
   return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
 }
 
-static int Fetch(int pc)
+static void Translate(unsigned page);
+
+static const struct mips_insn *Fetch(int pc)
 {
-  pc = (pc - 0x00400000) >> 2;
-  if ((unsigned)pc >= icount) {
+  // Both modes fault past the text, not on the zero fill of its last page
+  unsigned i = (unsigned)(pc - 0x00400000) >> 2;
+
+  if (i >= (unsigned)icount) {
     fprintf(stderr, "instruction fetch out of range\n");
     exit(-1);
   }
-  return instruction[pc];
+  if (unified) {
+    if (xlat[(unsigned)pc >> 12] == NULL) Translate((unsigned)pc >> 12);
+    return &xlat[(unsigned)pc >> 12][(pc & (PAGESIZE - 1)) >> 2];
+  }
+  return &decoded[i];
 }
 
 static int LoadWord(int addr)
@@ -29,6 +68,13 @@ static int LoadWord(int addr)
     fprintf(stderr, "unaligned data access\n");
     exit(-1);
   }
+  if (unified) {
+    if (upage[(unsigned)addr >> 12] == NULL) {
+      fprintf(stderr, "data access out of range\n");
+      exit(-1);
+    }
+    return upage[(unsigned)addr >> 12][(addr & (PAGESIZE - 1)) >> 2];
+  }
   addr -= 0x10000000;
   if ((unsigned)addr >= MEMSIZE) {
     fprintf(stderr, "data access out of range\n");
@@ -43,41 +89,26 @@ static void StoreWord(int data, int addr)
     fprintf(stderr, "unaligned data access\n");
     exit(-1);
   }
+  if (unified) {
+    unsigned page = (unsigned)addr >> 12;
+    if (upage[page] == NULL) {
+      fprintf(stderr, "data access out of range\n");
+      exit(-1);
+    }
+    upage[page][(addr & (PAGESIZE - 1)) >> 2] = data;
+    if (has_xlat[page >> 3] & (1 << (page & 7)))  // self-modifying code
+      xlat[page][(addr & (PAGESIZE - 1)) >> 2] = mips_decode(data, addr);
+    return;
+  }
   addr -= 0x10000000;
   if ((unsigned)addr >= MEMSIZE) {
     fprintf(stderr, "data access out of range\n");
     exit(-1);
   }
   mem[addr / 4] = data;
+  dirty[addr / PAGESIZE] = 1;
 }
 
-enum {
-  FUNCTION = 0x00,
-  J        = 0x02,
-  JAL      = 0x03,
-  BEQ      = 0x04,
-  BNE      = 0x05,
-  ADDIU    = 0x09,
-  ANDI     = 0x0C,
-  LUI      = 0x0F,
-  TRAP     = 0x1A,
-  LW       = 0x23,
-  SW       = 0x2B
-};
-
-enum {
-  SLL  = 0x00,
-  SRA  = 0x03,
-  JR   = 0x08,
-  MFHI = 0x10,
-  MFLO = 0x12,
-  MULT = 0x18,
-  DIV  = 0x1A,
-  ADDU = 0x21,
-  SUBU = 0x23,
-  SLT  = 0x2a
-};
-
 enum {
   NEWLINE = 0x00,
   PRINT   = 0x01,
@@ -85,98 +116,473 @@ enum {
   STOP    = 0x0a
 };
 
-static void Interpret(int start)
+// SPIM system call numbers, passed in $v0
+enum {
+  SYS_PRINT_INT    = 1,
+  SYS_PRINT_STRING = 4,
+  SYS_READ_INT     = 5,
+  SYS_READ_STRING  = 8,
+  SYS_SBRK         = 9,
+  SYS_EXIT         = 10,
+  SYS_PRINT_CHAR   = 11,
+  SYS_READ_CHAR    = 12,
+  SYS_OPEN         = 13,
+  SYS_READ         = 14,
+  SYS_WRITE        = 15,
+  SYS_CLOSE        = 16,
+  SYS_EXIT2        = 17
+};
+
+static void Translate(unsigned page)
+{
+  int c;
+
+  if (upage[page] == NULL) {
+    fprintf(stderr, "instruction fetch out of range\n");
+    exit(-1);
+  }
+  xlat[page] = (struct mips_insn *)(malloc(PAGESIZE / 4 * sizeof(struct mips_insn)));
+  if (xlat[page] == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  for (c = 0; c < PAGESIZE / 4; c++) {
+    xlat[page][c] = mips_decode(upage[page][c], (page << 12) + c * 4);
+  }
+  has_xlat[page >> 3] |= 1 << (page & 7);
+}
+
+static void MapUnified(void)
+{
+  /* Copy the text into its own pages and alias the data pages onto mem[]. */
+  unsigned page, first = 0x00400000 >> 12, last = (0x00400000 + icount * 4 + PAGESIZE - 1) >> 12;
+
+  for (page = first; page < last; page++) {
+    upage[page] = (int *)(calloc(PAGESIZE, 1));
+    if (upage[page] == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  for (page = 0; page < (unsigned)icount; page += PAGESIZE / 4) {
+    memcpy(upage[first + page / (PAGESIZE / 4)], instruction + page,
+           4 * (icount - page < PAGESIZE / 4 ? icount - page : PAGESIZE / 4));
+  }
+  for (page = 0; page < PAGES; page++) {
+    upage[(0x10000000 >> 12) + page] = &mem[page * (PAGESIZE / 4)];
+  }
+  unified = 1;
+}
+
+static void Predecode(void)
 {
-  register int instr, opcode, rs, rt, rd, shamt, funct, uimm, simm, addr, jaddr, baddr;
-  register int pc, hi, lo;
+  /* Split every instruction into its fields once, up front. */
+  int c;
+
+  decoded = (struct mips_insn *)(malloc(icount * sizeof(*decoded)));
+  if (decoded == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+
+  for (c = 0; c < icount; c++) {
+    decoded[c] = mips_decode(instruction[c], 0x00400000 + c * 4);
+  }
+}
+
+// Architectural state of a running program, so that it can be saved,
+// restored and resumed.
+struct machine {
+  int pc, hi, lo;
   int reg[32];
-  register int cont = 1, count = 0;
-  register long long wide;
+  int count;
+  int halted;
+  int brk;  // end of the sbrk heap
+};
+
+// PROMPT inputs are logged while recording so replays can feed them back
+// without touching stdin; output is suppressed while replaying.
+static int *input_log, inputs_logged, input_cursor;
+static int recording, replaying;
+
+static void Reset(struct machine *m, int start)
+{
+  memset(m, 0, sizeof(*m));
+  m->pc = start;
+  m->reg[28] = 0x10008000;  // gp
+  m->reg[29] = 0x10000000 + MEMSIZE;  // sp
+  m->brk = HEAPBASE;
+}
+
+static void LogInput(int value)
+{
+  if ((inputs_logged & (inputs_logged - 1)) == 0) {
+    input_log = (int *)(realloc(input_log, (inputs_logged ? 2 * inputs_logged : 1) * sizeof(int)));
+    if (input_log == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  input_log[inputs_logged++] = value;
+}
+
+/* Guest I/O. Every guest descriptor has an input and an output ring; guest
+ * reads are served from the input ring, which is refilled with one large
+ * host read when it runs dry, and guest writes accumulate in the output ring
+ * until it fills, the guest waits for input, closes the file or halts. So a
+ * guest printing a character at a time still costs one host write per 64 KiB.
+ * Guest descriptors 0-2 are the interpreter's own; open() only reaches plain
+ * file names inside the directory given with -d. Everything the host returns
+ * goes through Logged() so time-travel replays never touch the host. */
+
+#define RINGSIZE 65536
+#define GUESTFDS 16
+
+struct ring {
+  unsigned head, tail;  // free-running; tail - head bytes are buffered
+  char buf[RINGSIZE];
+};
+
+struct guestfile {
+  int fd;
+  struct ring in, out;
+};
+
+static struct guestfile *files[GUESTFDS];
+static int sandbox = -1;
+
+static int Logged(int value)
+{
+  if (replaying) return input_log[input_cursor++];
+  if (recording) LogInput(value);
+  return value;
+}
+
+static struct guestfile *File(int fd)
+{
+  if ((unsigned)fd >= GUESTFDS) return NULL;
+  if (files[fd] == NULL && fd <= 2) {
+    files[fd] = (struct guestfile *)(calloc(1, sizeof(struct guestfile)));
+    if (files[fd] == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+    files[fd]->fd = fd;
+  }
+  return files[fd];
+}
+
+static int Flush(struct guestfile *g)
+{
+  struct iovec iov[2];
+  unsigned head;
+  int n;
+
+  if (g->out.tail == g->out.head) return 0;
+  if (g->fd == 1) fflush(stdout);
+  while (g->out.tail != g->out.head) {
+    head = g->out.head % RINGSIZE;
+    iov[0].iov_base = g->out.buf + head;
+    iov[0].iov_len = g->out.tail - g->out.head < RINGSIZE - head ? g->out.tail - g->out.head : RINGSIZE - head;
+    iov[1].iov_base = g->out.buf;
+    iov[1].iov_len = g->out.tail - g->out.head - iov[0].iov_len;
+    n = writev(g->fd, iov, iov[1].iov_len ? 2 : 1);
+    if (n <= 0) {g->out.head = g->out.tail; return -1;}
+    g->out.head += n;
+  }
+  return 0;
+}
+
+static void Sync(void)
+{
+  // Keep TRAP output, which goes through stdio, in order with guest writes
+  if (files[1] != NULL) Flush(files[1]);
+}
+
+static int Put(struct guestfile *g, int c)
+{
+  if (g->out.tail - g->out.head == RINGSIZE && Flush(g) != 0) return -1;
+  g->out.buf[g->out.tail++ % RINGSIZE] = c;
+  return 0;
+}
+
+static int Get(struct guestfile *g)
+{
+  int n;
+
+  if (g->in.tail == g->in.head) {
+    if (g->fd == 0) {  // about to wait for the user: show what we have
+      Sync();
+      fflush(stdout);
+    }
+    g->in.head = g->in.tail = 0;
+    n = read(g->fd, g->in.buf, RINGSIZE);
+    if (n <= 0) return -1;
+    g->in.tail = n;
+  }
+  return (unsigned char)g->in.buf[g->in.head++ % RINGSIZE];
+}
+
+static int Peek(struct guestfile *g)
+{
+  int c = Get(g);
+  if (c >= 0) g->in.head--;
+  return c;
+}
+
+static int ReadInt(struct guestfile *g, int *value)
+{
+  /* Same as scanf("%d"): skip blanks, then an optional sign and digits.
+   * Out-of-range values are clamped to INT_MIN or INT_MAX, as strtol would. */
+  int c, sign = 1, digits = 0;
+  long long n = 0;
+
+  while ((c = Peek(g)) == ' ' || c == '\t' || c == '\n' || c == '\r') Get(g);
+  if (c == '-' || c == '+') {
+    Get(g);
+    if (c == '-') sign = -1;
+  }
+  while ((c = Peek(g)) >= '0' && c <= '9') {
+    Get(g);
+    if (n <= INT_MAX) n = n * 10 + (c - '0');  // past that it only clamps
+    digits++;
+  }
+  if (digits == 0) return 0;
+  n *= sign;
+  *value = n > INT_MAX ? INT_MAX : n < INT_MIN ? INT_MIN : (int)n;
+  return 1;
+}
+
+static int GuestByte(int addr)
+{
+  return (LoadWord(addr & ~3) >> (24 - 8 * (addr & 3))) & 0xff;
+}
+
+static void SetGuestByte(int addr, int c)
+{
+  int shift = 24 - 8 * (addr & 3);
+  int word = LoadWord(addr & ~3);
+
+  StoreWord((word & ~(0xff << shift)) | ((c & 0xff) << shift), addr & ~3);
+}
+
+static int OpenFile(int name, int flags, int mode)
+{
+  char path[256];
+  int i, fd, hostflags;
+
+  if (sandbox < 0) return -1;
+  for (i = 0; i < (int)sizeof(path) - 1 && (path[i] = GuestByte(name + i)) != 0; i++) {
+    if (path[i] == '/') return -1;
+  }
+  path[i] = 0;
+  if (i == 0 || strcmp(path, ".") == 0 || strcmp(path, "..") == 0) return -1;
+
+  for (i = 3; i < GUESTFDS && files[i] != NULL; i++) ;
+  if (i == GUESTFDS) return -1;
+
+  hostflags = ((flags & 3) == 0 ? O_RDONLY : (flags & 3) == 1 ? O_WRONLY : O_RDWR) | O_NOFOLLOW;
+  if (flags & 3) hostflags |= O_CREAT | (flags & 8 ? O_APPEND : O_TRUNC);
+  fd = openat(sandbox, path, hostflags, mode ? mode : 0644);
+  if (fd < 0) return -1;
+
+  files[i] = (struct guestfile *)(calloc(1, sizeof(struct guestfile)));
+  if (files[i] == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  files[i]->fd = fd;
+  return i;
+}
+
+static int CloseFile(int fd)
+{
+  struct guestfile *g = File(fd);
+  int result;
+
+  if (g == NULL) return -1;
+  result = Flush(g);
+  if (fd > 2) {
+    if (close(g->fd) != 0) result = -1;
+    free(g);
+    files[fd] = NULL;
+  }
+  return result;
+}
+
+static void CloseFiles(void)
+{
+  int fd;
+
+  for (fd = 0; fd < GUESTFDS; fd++) {
+    if (files[fd] != NULL) CloseFile(fd);
+  }
+}
+
+static int Syscall(struct machine *m, int pc)
+{
+  /* Returns 0 if the program should halt. */
+  int *reg = m->reg;
+  struct guestfile *g;
+  char text[16];
+  int i, c, n;
+
+  switch (reg[2]) {
+    case SYS_PRINT_INT:
+      n = snprintf(text, sizeof(text), "%d", reg[4]);
+      for (i = 0; i < n && !replaying; i++) Put(File(1), text[i]);
+      break;
+
+    case SYS_PRINT_STRING:
+      for (i = reg[4]; (c = GuestByte(i)) != 0; i++) {
+        if (!replaying) Put(File(1), c);
+      }
+      break;
+
+    case SYS_PRINT_CHAR:
+      if (!replaying) Put(File(1), reg[4]);
+      break;
+
+    case SYS_READ_INT:
+      n = 0;
+      if (!replaying) ReadInt(File(0), &n);
+      reg[2] = Logged(n);
+      break;
+
+    case SYS_READ_CHAR:
+      reg[2] = Logged(replaying ? 0 : Get(File(0)));
+      break;
+
+    case SYS_READ_STRING:
+      // Like fgets: up to $a1 - 1 characters, stopping after a newline
+      for (i = 0; i < reg[5] - 1; i++) {
+        c = Logged(replaying ? 0 : Get(File(0)));
+        if (c < 0) break;
+        SetGuestByte(reg[4] + i, c);
+        if (c == '\n') {i++; break;}
+      }
+      if (reg[5] > 0) SetGuestByte(reg[4] + i, 0);
+      break;
+
+    case SYS_SBRK:
+      if (m->brk + reg[4] < HEAPBASE || m->brk + reg[4] > reg[29]) {
+        reg[2] = -1;
+        break;
+      }
+      reg[2] = m->brk;
+      m->brk = (m->brk + reg[4] + 3) & ~3;
+      break;
+
+    case SYS_OPEN:
+      reg[2] = Logged(replaying ? 0 : OpenFile(reg[4], reg[5], reg[6]));
+      break;
+
+    case SYS_READ:
+      // Only the first byte may block; each byte is logged, then a -1
+      g = File(reg[4]);
+      for (n = 0; ; n++) {
+        c = -1;
+        if (!replaying && g != NULL && n < reg[6] && (n == 0 || g->in.tail != g->in.head))
+          c = Get(g);
+        if ((c = Logged(c)) < 0) break;
+        SetGuestByte(reg[5] + n, c);
+      }
+      reg[2] = Logged(g == NULL && !replaying ? -1 : n);
+      break;
+
+    case SYS_WRITE:
+      g = File(reg[4]);
+      n = -1;
+      if (g != NULL && !replaying) {
+        for (n = 0; n < reg[6] && Put(g, GuestByte(reg[5] + n)) == 0; n++) ;
+        if (g->fd > 2 && n < reg[6]) n = -1;
+      }
+      reg[2] = Logged(n);
+      break;
+
+    case SYS_CLOSE:
+      reg[2] = Logged(replaying ? 0 : CloseFile(reg[4]));
+      break;
+
+    case SYS_EXIT:
+    case SYS_EXIT2:
+      return 0;
+
+    default:
+      fprintf (stderr, "unimplemented syscall %d: pc = 0x%x\n", reg[2], pc-4);
+      return 0;
+  }
+  return 1;
+}
 
-  pc = start;
-  reg[28] = 0x10008000;  // gp
-  reg[29] = 0x10000000 + MEMSIZE;  // sp
+static void Run(struct machine *m, int stop)
+{
+  /* Execute until the program halts or `stop' instructions have been
+   * executed in total; pass -1 to run to completion. */
+  register const struct mips_insn *d;
+  register int rs, rt, rd, shamt, uimm, simm, target;
+  register int pc = m->pc, hi = m->hi, lo = m->lo;
+  int *reg = m->reg;
+  register int cont = !m->halted, count = m->count;
+  register long long wide;
 
-  while (cont) {
+  while (cont && count != stop) {
     count++;
-    instr = Fetch(pc);
+    d = Fetch(pc);
     pc += 4;
     reg[0] = 0;  // $zero
 
-    opcode = (unsigned)instr >> 26;
-    rs = (instr >> 21) & 0x1f;
-    rt = (instr >> 16) & 0x1f;
-    rd = (instr >> 11) & 0x1f;
-    shamt = (instr >> 6) & 0x1f;
-    funct = instr & 0x3f;
-    uimm = instr & 0xffff;
-    simm = ((signed)uimm << 16) >> 16;
-    addr = instr & 0x3ffffff;
-    jaddr = (pc & 0xf0000000) + addr * 4;
-    baddr = pc + simm * 4;
-
-    switch (opcode) {
-      case FUNCTION:
-        switch (funct) {
-          case SLL: reg [rd] = reg [rs] << shamt; break;
-          case SRA: reg [rd] = reg [rs] >> shamt; break;
-          case JR: pc = reg [rs]; break;
-          case MFHI: reg [rd] = hi; break;
-          case MFLO: reg [rd] = lo; break;
-
-          case MULT:
-            wide = reg [rs] * reg [rt];
-            lo = wide & 0xffffffff;
-            hi = wide >> 32;
-            break;
-          case DIV:
-            if (reg [rt] == 0) {
-              fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
-              cont = 0;
-            } else {
-              lo = reg [rs] / reg [rt];
-              hi = reg [rs] % reg [rt];
-            }
-            break;
+    rs = d->rs;
+    rt = d->rt;
+    rd = d->rd;
+    shamt = d->shamt;
+    uimm = d->uimm;
+    simm = d->simm;
+    target = d->target;
 
-          case ADDU: reg [rd] = reg [rs] + reg [rt]; break;
-          case SUBU: reg [rd] = reg [rs] - reg [rt]; break;
-          case SLT: reg [rd] = (reg [rs] < reg [rt] ? 1 : 0); break;
+    switch (d->op) {
+      case MIPS_SLL: reg [rd] = reg [rs] << shamt; break;
+      case MIPS_SRA: reg [rd] = reg [rs] >> shamt; break;
+      case MIPS_JR: pc = reg [rs]; break;
+      case MIPS_MFHI: reg [rd] = hi; break;
+      case MIPS_MFLO: reg [rd] = lo; break;
 
-          default:
-            fprintf (stderr, "unimplemented instruction: pc = 0x%x\n", pc-4);
-            cont = 0;
+      case MIPS_MULT:
+        wide = reg [rs] * reg [rt];
+        lo = wide & 0xffffffff;
+        hi = wide >> 32;
+        break;
+      case MIPS_DIV:
+        if (reg [rt] == 0) {
+          fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
+          cont = 0;
+        } else {
+          lo = reg [rs] / reg [rt];
+          hi = reg [rs] % reg [rt];
         }
         break;
 
-      case J:
-        pc = jaddr;
+      case MIPS_ADDU: reg [rd] = reg [rs] + reg [rt]; break;
+      case MIPS_SUBU: reg [rd] = reg [rs] - reg [rt]; break;
+      case MIPS_SLT: reg [rd] = (reg [rs] < reg [rt] ? 1 : 0); break;
+      case MIPS_SYSCALL: cont = Syscall (m, pc); break;
+
+      case MIPS_J:
+        pc = target;
         break;
-      case JAL:
+      case MIPS_JAL:
         reg [31] = pc;
-        pc = jaddr;
+        pc = target;
         break;
-      case BEQ:
+      case MIPS_BEQ:
         if (reg [rs] == reg [rt])
-          pc = baddr;
+          pc = target;
         break;
-      case BNE:
+      case MIPS_BNE:
         if (reg [rs] != reg [rt])
-          pc = baddr;
+          pc = target;
         break;
 
-      case ADDIU: reg [rt] = reg [rs] + simm; break;
-      case ANDI: reg [rt] = reg [rs] & uimm; break;
-      case LUI: reg [rt] = simm << 16; break;
+      case MIPS_ADDIU: reg [rt] = reg [rs] + simm; break;
+      case MIPS_ANDI: reg [rt] = reg [rs] & uimm; break;
+      case MIPS_LUI: reg [rt] = simm << 16; break;
 
-      case TRAP:
-        switch (addr & 0xf) {
-          case NEWLINE: printf ("\n"); break;
-          case PRINT: printf (" %d", reg [rs]); break;
+      case MIPS_TRAP:
+        switch (uimm & 0xf) {
+          case NEWLINE: if (!replaying) Sync (), printf ("\n"); break;
+          case PRINT: if (!replaying) Sync (), printf (" %d", reg [rs]); break;
           case PROMPT:
+            if (replaying) {
+              reg [rt] = input_log [input_cursor++];
+              break;
+            }
+            Sync ();
             printf ("\n? ");
             fflush (stdout);
-            scanf ("%d", &reg [rt]);
+            ReadInt (File (0), &reg [rt]);
+            if (recording) LogInput (reg [rt]);
             break;
           case STOP: cont = 0; break;
           default:
@@ -185,8 +591,8 @@ static void Interpret(int start)
         }
         break;
 
-      case LW: reg [rt] = LoadWord (reg [rs] + simm); break;
-      case SW: StoreWord (reg [rt], reg [rs] + simm); break;
+      case MIPS_LW: reg [rt] = LoadWord (reg [rs] + simm); break;
+      case MIPS_SW: StoreWord (reg [rt], reg [rs] + simm); break;
 
       default:
         fprintf (stderr, "unimplemented instruction: pc = 0x%x\n", pc-4);
@@ -194,21 +600,468 @@ static void Interpret(int start)
     }
   }
 
-  printf("\nprogram finished at pc = 0x%x  (%d instructions executed)\n", pc, count);
+  m->pc = pc;
+  m->hi = hi;
+  m->lo = lo;
+  m->count = count;
+  m->halted = !cont;
+}
+
+/* Time travel. While recording, a checkpoint is taken every CHECKPOINT
+ * instructions; checkpoint n holds the registers, the input-log position and
+ * a copy of every page dirtied since the checkpoint before it. Checkpoint n
+ * has level ctz(n) and only the two most recent checkpoints of each level are
+ * kept, so the checkpoints thin out exponentially with age and their number
+ * (and memory) grows only with the log of the run length. A dropped
+ * checkpoint's pages are folded into its successor. Seeking restores the
+ * latest checkpoint at or before the target and replays forward. */
+
+#define CHECKPOINT 4096
+
+struct checkpoint {
+  struct machine m;
+  int inputs;
+  int level;
+  int npages;
+  unsigned char has[PAGES];
+  short *page;  // page numbers, npages of them
+  int *data;    // their contents at m.count
+};
+
+static struct checkpoint *checkpoints;
+static int ncheckpoints;
+
+static void AddPage(struct checkpoint *c, int page, const int *data)
+{
+  if ((c->npages & (c->npages - 1)) == 0) {
+    c->page = (short *)(realloc(c->page, (c->npages ? 2 * c->npages : 1) * sizeof(short)));
+    c->data = (int *)(realloc(c->data, (c->npages ? 2 * c->npages : 1) * PAGESIZE));
+    if (c->page == NULL || c->data == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  c->has[page] = 1;
+  c->page[c->npages] = page;
+  memcpy(c->data + c->npages * (PAGESIZE / 4), data, PAGESIZE);
+  c->npages++;
+}
+
+static void Checkpoint(const struct machine *m, int level)
+{
+  struct checkpoint *c, *next;
+  int i, p, same;
+
+  checkpoints = (struct checkpoint *)(realloc(checkpoints, (ncheckpoints + 1) * sizeof(*checkpoints)));
+  if (checkpoints == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  c = &checkpoints[ncheckpoints++];
+  memset(c, 0, sizeof(*c));
+  c->m = *m;
+  c->inputs = inputs_logged;
+  c->level = level;
+  for (p = 0; p < PAGES; p++) {
+    if (dirty[p]) AddPage(c, p, &mem[p * (PAGESIZE / 4)]);
+  }
+  memset(dirty, 0, sizeof(dirty));
+
+  // Drop the oldest checkpoint of this level if there are now three of them
+  same = 0;
+  for (i = ncheckpoints - 1; i > 0; i--) {
+    if (checkpoints[i].level == level && ++same == 3) break;
+  }
+  if (i == 0) return;
+
+  c = &checkpoints[i];
+  next = &checkpoints[i + 1];
+  for (p = 0; p < c->npages; p++) {
+    if (!next->has[c->page[p]]) AddPage(next, c->page[p], c->data + p * (PAGESIZE / 4));
+  }
+  free(c->page);
+  free(c->data);
+  memmove(c, next, (ncheckpoints - i - 1) * sizeof(*c));
+  ncheckpoints--;
+}
+
+static void Record(struct machine *m)
+{
+  int n;
+
+  recording = 1;
+  Checkpoint(m, 32);  // the initial state is never dropped
+  for (n = 1; !m->halted; n++) {
+    Run(m, n * CHECKPOINT);
+    if (!m->halted) Checkpoint(m, __builtin_ctz(n));
+  }
+  recording = 0;
+}
+
+static void Seek(struct machine *m, int target)
+{
+  static unsigned char restored[PAGES];
+  int i, p;
+
+  for (i = ncheckpoints - 1; i > 0 && checkpoints[i].m.count > target; i--) ;
+
+  if (m->count > target || m->count < checkpoints[i].m.count) {
+    memset(restored, 0, sizeof(restored));
+    *m = checkpoints[i].m;
+    input_cursor = checkpoints[i].inputs;
+    for (; i >= 0; i--) {
+      for (p = 0; p < checkpoints[i].npages; p++) {
+        if (!restored[checkpoints[i].page[p]]) {
+          restored[checkpoints[i].page[p]] = 1;
+          memcpy(&mem[checkpoints[i].page[p] * (PAGESIZE / 4)],
+                 checkpoints[i].data + p * (PAGESIZE / 4), PAGESIZE);
+        }
+      }
+    }
+    for (p = 0; p < PAGES; p++) {
+      if (!restored[p]) memset(&mem[p * (PAGESIZE / 4)], 0, PAGESIZE);
+    }
+  }
+
+  replaying = 1;
+  Run(m, target);
+  replaying = 0;
+}
+
+static void Travel(struct machine *m, const char *commands)
+{
+  /* Read time-travel commands once the recorded run has finished:
+   *   goto N       state after N instructions
+   *   step [K]     forward K instructions (default 1)
+   *   back [K]     backward K instructions (default 1)
+   *   regs         dump the registers
+   *   mem ADDR [N] dump N words of memory from ADDR (default 1)
+   *   quit */
+  int last = m->count, arg, n, i;
+  char line[256], cmd[16];
+  unsigned addr;
+  FILE *f;
+
+  f = fopen(commands, "r");
+  if (f == NULL) {fprintf(stderr, "error: could not open file %s\n", commands); exit(-1);}
+
+  for (;;) {
+    fprintf(stderr, "(%d) ", m->count);
+    if (fgets(line, sizeof(line), f) == NULL) break;
+    n = sscanf(line, "%15s %i", cmd, &arg);
+    if (n < 1) continue;
+
+    if (strcmp(cmd, "quit") == 0) {
+      break;
+    } else if (strcmp(cmd, "goto") == 0 || strcmp(cmd, "step") == 0 || strcmp(cmd, "back") == 0) {
+      if (cmd[0] == 'g' && n < 2) {fprintf(stderr, "goto needs an instruction number\n"); continue;}
+      if (n < 2) arg = 1;
+      if (cmd[0] == 's') arg = m->count + arg;
+      if (cmd[0] == 'b') arg = m->count - arg;
+      if (arg < 0) arg = 0;
+      if (arg > last) arg = last;
+      Seek(m, arg);
+      fprintf(stderr, "instruction %d: pc = 0x%x\n", m->count, m->pc);
+    } else if (strcmp(cmd, "regs") == 0) {
+      for (i = 0; i < 32; i++) {
+        fprintf(stderr, "%5s = %08x%s", mips_regname[i], i == 0 ? 0 : m->reg[i], i % 4 == 3 ? "\n" : "  ");
+      }
+      fprintf(stderr, "   hi = %08x     lo = %08x     pc = %08x\n", m->hi, m->lo, m->pc);
+    } else if (strcmp(cmd, "mem") == 0 && n == 2) {
+      if (sscanf(line, "%*s %i %i", &arg, &n) < 2) n = 1;
+      for (addr = arg & ~3; n-- > 0; addr += 4) {
+        if (addr - 0x10000000 >= MEMSIZE) {fprintf(stderr, "%8x: out of range\n", addr); break;}
+        fprintf(stderr, "%8x: %08x\n", addr, mem[(addr - 0x10000000) / 4]);
+      }
+    } else {
+      fprintf(stderr, "commands: goto N, step [K], back [K], regs, mem ADDR [N], quit\n");
+    }
+  }
+  fclose(f);
+}
+
+static void Interpret(int start, const char *travel)
+{
+  struct machine m;
+
+  Reset(&m, start);
+  if (travel != NULL)
+    Record(&m);
+  else
+    Run(&m, -1);
+  CloseFiles();
+
+  printf("\nprogram finished at pc = 0x%x  (%d instructions executed)\n", m.pc, m.count);
+
+  if (travel != NULL) {
+    fflush(stdout);
+    Travel(&m, travel);
+  }
+}
+
+// Layout of a program cache file: this header, then the host-endian text,
+// then the decoded records, back to back.
+struct cacheheader {
+  char magic[8];
+  unsigned long long hash;  // of the .mips file the cache was built from
+  unsigned long long isa;   // of the instruction table the records index
+  int icount, start;
+  int record_size, little_endian;
+};
+
+static const char cachemagic[8] = "CS3339\0\3";
+static unsigned long long binary_hash;
+static void *cache_map;
+
+static unsigned long long Hash(const char *name)
+{
+  /* FNV-1a, eight bytes at a time, over the whole executable. */
+  unsigned long long h = 0xcbf29ce484222325ULL, w;
+  struct stat st;
+  unsigned char *p;
+  size_t i;
+  int fd;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {fprintf(stderr, "error: could not open file %s\n", name); exit(-1);}
+  p = (unsigned char *)(st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL);
+  close(fd);
+  if (p == MAP_FAILED) {fprintf(stderr, "error: could not map file %s\n", name); exit(-1);}
+
+  for (i = 0; i + 8 <= (size_t)st.st_size; i += 8) {
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (; i < (size_t)st.st_size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  h = (h ^ st.st_size) * 0x100000001b3ULL;
+
+  if (p != NULL) munmap(p, st.st_size);
+  return h;
+}
+
+static unsigned long long IsaHash(void)
+{
+  /* Decoded records hold op numbers, which follow the order of the rows in
+   * MIPS_INSTRUCTIONS; a cache built against another table must not load. */
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  const char *c;
+  int op;
+
+  for (op = 0; op < MIPS_OPS; op++) {
+    for (c = mips_desc[op].mnemonic; *c != '\0'; c++)
+      h = (h ^ (unsigned char)*c) * 0x100000001b3ULL;
+    h = (h ^ mips_desc[op].opcode) * 0x100000001b3ULL;
+    h = (h ^ mips_desc[op].funct) * 0x100000001b3ULL;
+  }
+  return (h ^ MIPS_OPS) * 0x100000001b3ULL;
+}
+
+static void CachePath(char *path, size_t size, const char *dir)
+{
+  snprintf(path, size, "%s/%016llx.mc", dir, binary_hash);
+}
+
+static size_t CacheSize(int count)
+{
+  return sizeof(struct cacheheader) + count * (4 + sizeof(struct mips_insn));
+}
+
+static int MapCache(const char *dir, int *start)
+{
+  /* Point instruction[] and decoded[] straight into a previously
+   * written cache file. Returns 0 if there is no usable cache. */
+  const struct cacheheader *h;
+  struct stat st;
+  char path[4096];
+  int fd;
+
+  CachePath(path, sizeof(path), dir);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*h)) {close(fd); return 0;}
+  cache_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (cache_map == MAP_FAILED) {cache_map = NULL; return 0;}
+
+  h = (const struct cacheheader *)cache_map;
+  if (memcmp(h->magic, cachemagic, sizeof(cachemagic)) != 0 || h->hash != binary_hash ||
+      h->isa != IsaHash() ||
+      h->record_size != sizeof(struct mips_insn) || h->little_endian != little_endian ||
+      h->icount < 0 || (size_t)st.st_size != CacheSize(h->icount)) {
+    munmap(cache_map, st.st_size);
+    cache_map = NULL;
+    return 0;
+  }
+
+  icount = h->icount;
+  *start = h->start;
+  instruction = (int *)(h + 1);
+  decoded = (struct mips_insn *)(instruction + icount);
+  return 1;
+}
+
+static void StoreCache(const char *dir, int start)
+{
+  /* Write the cache under a temporary name and rename it into place so
+   * concurrent runs never map a half-written file. Failure is not fatal. */
+  struct cacheheader h;
+  char path[4096], temp[4096 + 32];
+  FILE *f;
+  int ok;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, cachemagic, sizeof(cachemagic));
+  h.hash = binary_hash;
+  h.isa = IsaHash();
+  h.icount = icount;
+  h.start = start;
+  h.record_size = sizeof(struct mips_insn);
+  h.little_endian = little_endian;
+
+  CachePath(path, sizeof(path), dir);
+  snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+  f = fopen(temp, "wb");
+  if (f == NULL) {fprintf(stderr, "warning: could not write cache %s\n", path); return;}
+  ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+       fwrite(instruction, 4, icount, f) == (size_t)icount &&
+       fwrite(decoded, sizeof(*decoded), icount, f) == (size_t)icount;
+  if (fclose(f) != 0 || !ok || rename(temp, path) != 0) {
+    fprintf(stderr, "warning: could not write cache %s\n", path);
+    unlink(temp);
+  }
+}
+
+static int Connect(const char *path, int listening)
+{
+  struct sockaddr_un sa;
+  struct stat st;
+  int fd;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(sa.sun_path)) {fprintf(stderr, "error: socket path too long: %s\n", path); exit(-1);}
+  strcpy(sa.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {perror("socket"); exit(-1);}
+  if (listening) {
+    // Replace a stale socket, but never remove anything else
+    if (lstat(path, &st) == 0) {
+      if (!S_ISSOCK(st.st_mode)) {fprintf(stderr, "error: %s exists and is not a socket\n", path); exit(-1);}
+      unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {perror(path); exit(-1);}
+    if (listen(fd, 64) != 0) {perror("listen"); exit(-1);}
+  } else {
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {perror(path); exit(-1);}
+  }
+  return fd;
+}
+
+static void Serve(const char *path, const char *name, int start, const char *travel)
+{
+  /* Fork-server mode. The program has already been loaded and byte-swapped;
+   * every connection on the socket gets a copy-on-write child whose stdin is
+   * the job's input (PROMPT values) and whose stdout/stderr go back over the
+   * same connection, so a job costs one fork instead of a full startup. */
+  int sock, conn;
+
+  sock = Connect(path, 1);
+  signal(SIGCHLD, SIG_IGN);  // let the kernel reap finished jobs
+  fprintf(stderr, "serving %s on %s\n", name, path);
+  fflush(stdout);
+
+  for (;;) {
+    conn = accept(sock, NULL, NULL);
+    if (conn < 0) {perror("accept"); continue;}
+    switch (fork()) {
+      case -1:
+        perror("fork");
+        break;
+      case 0:
+        close(sock);
+        dup2(conn, 0);
+        dup2(conn, 1);
+        dup2(conn, 2);
+        close(conn);
+        printf("CS3339 MIPS Interpreter\n");
+        printf("running %s\n\n", name);
+        Interpret(start, travel);
+        fflush(stdout);
+        _exit(0);
+    }
+    close(conn);
+  }
+}
+
+static void Client(const char *path)
+{
+  /* Submit one job to a fork server: stdin is forwarded as the job's input
+   * and everything the job prints is copied to stdout. Both directions are
+   * pumped together so a chatty program can't deadlock against its input. */
+  struct pollfd p[2];
+  char buf[65536];
+  int sock, n;
+
+  sock = Connect(path, 0);
+  p[0].fd = 0;
+  p[0].events = POLLIN;
+  p[1].fd = sock;
+  p[1].events = POLLIN;
+
+  while (p[1].fd >= 0) {
+    if (poll(p, 2, -1) < 0) {perror("poll"); exit(-1);}
+    if (p[0].revents) {
+      n = read(0, buf, sizeof(buf));
+      if (n <= 0 || write(sock, buf, n) != n) {
+        shutdown(sock, SHUT_WR);
+        p[0].fd = -1;
+      }
+    }
+    if (p[1].revents) {
+      n = read(sock, buf, sizeof(buf));
+      if (n <= 0 || write(1, buf, n) != n) p[1].fd = -1;
+    }
+  }
+  close(sock);
 }
 
 int main(int argc, char *argv[])
 {
   int c, start;
+  const char *server = NULL, *cachedir = NULL, *travel = NULL;
+  int unify = 0;
+  const char *sandboxdir = NULL;
   FILE *f;
 
+  while ((c = getopt(argc, argv, "s:c:C:t:ud:")) != -1) {
+    switch (c) {
+      case 's': server = optarg; break;
+      case 'C': cachedir = optarg; break;
+      case 't': travel = optarg; break;
+      case 'u': unify = 1; break;
+      case 'd': sandboxdir = optarg; break;
+      case 'c': Client(optarg); return 0;
+      default: argc = 0;
+    }
+  }
+  if (unify && travel != NULL) {fprintf(stderr, "error: -t does not support -u\n"); exit(-1);}
+  if (argc - optind != 1) {fprintf(stderr, "usage: %s [-u] [-d sandbox] [-C cachedir] [-t commands] [-s socket] executable\n       %s -c socket\n", argv[0], argv[0]); exit(-1);}
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (sandboxdir != NULL) {
+    sandbox = open(sandboxdir, O_RDONLY | O_DIRECTORY);
+    if (sandbox < 0) {fprintf(stderr, "error: could not open directory %s\n", sandboxdir); exit(-1);}
+  }
+  // Faults exit() from deep inside Run; flush what the guest wrote first
+  atexit(CloseFiles);
+
   printf("CS3339 MIPS Interpreter\n");
-  if (argc != 2) {fprintf(stderr, "usage: %s executable\n", argv[0]); exit(-1);}
   if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
   if (sizeof(long long) != 8) {fprintf(stderr, "error: need 8-byte long longs\n"); exit(-1);}
 
   c = 1;
   little_endian = *((char *)&c);
+  if (cachedir != NULL) {
+    binary_hash = Hash(argv[1]);
+    if (MapCache(cachedir, &start)) goto loaded;
+  }
+
   f = fopen(argv[1], "r+b");
   if (f == NULL) {fprintf(stderr, "error: could not open file %s\n", argv[1]); exit(-1);}
   c = fread(&icount, 4, 1, f);
@@ -232,10 +1085,26 @@ int main(int argc, char *argv[])
       instruction[c] = Convert(instruction[c]);
     }
   }
+  Predecode();
+  if (cachedir != NULL) {
+    StoreCache(cachedir, start);
+  }
+
+loaded:
+  if (unify) {
+    MapUnified();
+  }
+
+  if (server != NULL) {
+    Serve(server, argv[1], start, travel);
+  }
 
   printf("running %s\n\n", argv[1]);
-  Interpret(start);
+  Interpret(start, travel);
 
-  free (instruction);
+  if (cache_map == NULL) {
+    free (instruction);
+    free (decoded);
+  }
   return 0;
 }
@@ -1,5 +1,7 @@
 /* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; smart-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
 
+#define _POSIX_C_SOURCE 200809L
+
 #if __STDC_VERSION__ < 199901L
 # warning "This program should be compiled as C99 or better"
 #endif
@@ -8,17 +10,219 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
+#include <math.h>
 #include <assert.h>
+#include <unistd.h>
+
+#include "../common/mips.h"
+#include "../common/interval.h"
 
 #define MEMSIZE 1048576
+#define TEXT 0x00400000  // where the text is loaded, whatever the entry
 #define ARRAYLEN(NAME) (sizeof (NAME) / sizeof (*NAME))
 
 typedef int_least64_t integer;
 #define PR_INTEGER PRIdLEAST64
 
 static int little_endian, icount, *instruction;
+static int depth = 3;  // longest dependency distance kept apart (-d)
+static int histogram;
+static int hotspots;   // lines in the per-PC report (-p)
+
+// Per static instruction, indexed by (pc - TEXT) / 4 as Fetch does
+struct profile {
+  integer count;   // executions
+  integer cycles;  // cycles charged, including taken-branch penalties
+  integer taken;   // taken branches
+  integer stalls;  // inputs produced by the instruction just before
+};
+
+static struct profile *profile;
+
+/* Cost models (-c file). Cycle totals are linear in the per-op counts and the
+ * taken-branch count, so any number of models is costed after the run by one
+ * dot product each. Each line of the file is a model:
+ *
+ *   name [mnemonic=cycles ...] [taken=cycles]
+ *
+ * where anything not given keeps its icycles value (taken branches: 2), and
+ * '#' starts a comment. The weights are stored feature-major so that the
+ * evaluation loop runs across models and vectorizes. */
+#define FEATURES (MIPS_OPS + 1)  // the ops, then taken branches
+#define TAKEN MIPS_OPS
+
+static int models;
+static char (*model_name)[32];
+static double *model_weight;  // [FEATURES][models]
+
+/* Basic-block vectors (-i interval). Every `interval' instructions the number
+ * of instructions executed in each basic block, keyed by the profile index
+ * of the block's entry (so from TEXT, not the entry pc), is saved as a sparse
+ * vector: only the blocks touched in the interval are stored. At exit the
+ * vectors are randomly projected down to BBV_DIMS dimensions and clustered
+ * with k-means (-k clusters); the interval closest to each centroid is a
+ * simulation point, weighted by its cluster's share of the run. -r writes
+ * the points as a region list for the simulators (see common/regions.h), -v
+ * the raw vectors in SimPoint's .bb format. */
+#define BBV_DIMS 15
+
+struct bbv_pair {
+  uint32_t block, count;
+};
+
+static int interval, clusters = 10;
+static const char *region_file, *bbv_file;
+static uint32_t *bbv;                 // [icount], the interval being counted
+static int *touched, ntouched;        // its nonzero entries
+static struct bbv_pair *pairs;        // every interval's vector, in order
+static size_t npairs, pairs_capacity;
+static size_t *first_pair;            // [intervals + 1]
+static integer *interval_length;
+static int intervals, intervals_capacity;
+
+/* Data locality (-b block, -w window). Every LoadWord and StoreWord address
+ * is reduced to a block of `block_size' bytes. -b gives each access's LRU
+ * stack distance, the number of distinct other blocks touched since the
+ * block's last access, which is below C exactly when a fully associative LRU
+ * cache of C blocks would hit. Each block's last access is marked in a
+ * Fenwick tree indexed by time, so a distance is two prefix sums. Only one
+ * mark per block is ever live, so when the clock reaches the end of the tree
+ * the live marks are renumbered in order to its start: memory stays at a few
+ * words per block of data memory however long the run. -w counts the distinct
+ * blocks touched in each window of instructions. */
+static int block_size, block_bits, blocks;
+static int reuse;
+static int *last_use;               // [blocks], time of the last access or 0
+static int *fenwick, *owner;        // [clock_capacity + 1]
+static int now, clock_capacity;      // the clock: the time of the latest access
+static integer reuse_cold, *reuse_counts;  // by ReuseBucket of the distance
+static int window;
+static int *window_stamp, working_set;     // [blocks], the window last touched in
+static integer windows, working_set_min, working_set_max, working_set_sum;
 static int mem[MEMSIZE / 4];
 
+#define HILO 32  // the slot for the multiplication/division registers
+
+// -o log [-n instructions]: interval rows, see common/interval.h
+static struct mips_interval interval_log;
+
+static int ReuseBucket(int d)
+/* 0 for distance 0, else 1 + floor(log2 d) */
+{
+  int b = 0;
+
+  while (d > 0) {
+    d >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static int Prefix(int t)
+{
+  int sum = 0;
+
+  for (; t > 0; t -= t & -t) {
+    sum += fenwick [t];
+  }
+  return sum;
+}
+
+static void Mark(int t, int delta)
+{
+  for (; t <= clock_capacity; t += t & -t) {
+    fenwick [t] += delta;
+  }
+}
+
+static void Renumber(void)
+/* Moves the live marks to times 1 .. live, keeping their order */
+{
+  int t, b, live = 0;
+
+  for (t = 1; t <= clock_capacity; t++) {
+    owner [t] = -1;
+  }
+  for (b = 0; b < blocks; b++) {
+    if (last_use [b] != 0) owner [last_use [b]] = b;
+  }
+  memset (fenwick, 0, (clock_capacity + 1) * sizeof (*fenwick));
+  for (t = 1; t <= clock_capacity; t++) {
+    if (owner [t] >= 0) {
+      last_use [owner [t]] = ++live;
+      fenwick [live] = 1;
+    }
+  }
+  // Linear-time build: each node passes its total up to its parent
+  for (t = 1; t <= clock_capacity; t++) {
+    if (t + (t & -t) <= clock_capacity) fenwick [t + (t & -t)] += fenwick [t];
+  }
+  now = live;
+}
+
+static void Access(int offset)
+/* Accounts one access at `offset' bytes into data memory */
+{
+  int b = offset >> block_bits;
+
+  if (window && window_stamp [b] != windows + 1) {
+    window_stamp [b] = windows + 1;
+    working_set++;
+  }
+  if (reuse) {
+    if (now == clock_capacity) Renumber ();
+    if (last_use [b] == 0) {
+      reuse_cold++;
+    } else {
+      reuse_counts [ReuseBucket (Prefix (now) - Prefix (last_use [b]))]++;
+      Mark (last_use [b], -1);
+    }
+    last_use [b] = ++now;
+    Mark (now, 1);
+  }
+}
+
+static void EndWindow(void)
+{
+  if (windows == 0 || working_set < working_set_min) working_set_min = working_set;
+  if (working_set > working_set_max) working_set_max = working_set;
+  working_set_sum += working_set;
+  working_set = 0;
+  windows++;
+}
+
+static void Locality(void)
+{
+  integer accesses = reuse_cold, cumulative = 0;
+  int b, buckets = block_bits ? ReuseBucket (blocks) + 1 : 0;
+
+  if (reuse) {
+    for (b = 0; b < buckets; b++) {
+      accesses += reuse_counts [b];
+    }
+    printf ("\nreuse distance (%d-byte blocks, %"PR_INTEGER" accesses):\n", block_size, accesses);
+    printf ("%22s %12s %8s %8s\n", "distance", "accesses", "", "LRU hit");
+    for (b = 0; b < buckets; b++) {
+      cumulative += reuse_counts [b];
+      if (reuse_counts [b] == 0) continue;
+      if (b < 2) printf ("%22d", b);
+      else printf ("%10d .. %8d", 1 << (b - 1), (1 << b) - 1);
+      // Through bucket b is the hit rate of an LRU cache of 1 << b blocks
+      printf (" %12"PR_INTEGER" %7.2f%% %7.2f%%\n", reuse_counts [b],
+              100.0 * reuse_counts [b] / accesses, 100.0 * cumulative / accesses);
+    }
+    printf ("%22s %12"PR_INTEGER" %7.2f%%\n", "first use", reuse_cold, 100.0 * reuse_cold / accesses);
+  }
+  if (window) {
+    if (working_set > 0 || windows == 0) EndWindow ();
+    printf ("\nworking set per %d instructions (%"PR_INTEGER" windows, %d-byte blocks):\n", window, windows, block_size);
+    printf ("min %"PR_INTEGER" blocks (%"PR_INTEGER" bytes), max %"PR_INTEGER" blocks (%"PR_INTEGER" bytes), mean %.1f blocks\n",
+            working_set_min, working_set_min * block_size, working_set_max, working_set_max * block_size,
+            (double) working_set_sum / windows);
+  }
+}
+
 static int Convert(unsigned int x)
 {
   return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
@@ -26,8 +230,8 @@ static int Convert(unsigned int x)
 
 static int Fetch(int pc)
 {
-  pc = (pc - 0x00400000) >> 2;
-  if (pc >= icount) {
+  pc = (pc - TEXT) >> 2;
+  if ((unsigned) pc >= (unsigned) icount) {
     fprintf(stderr, "instruction fetch out of range\n");
     exit(-1);
   }
@@ -45,6 +249,7 @@ static int LoadWord(int addr)
     fprintf(stderr, "data access out of range\n");
     exit(-1);
   }
+  if (block_bits) Access(addr);
   return mem[addr / 4];
 }
 
@@ -59,36 +264,10 @@ static void StoreWord(int data, int addr)
     fprintf(stderr, "data access out of range\n");
     exit(-1);
   }
+  if (block_bits) Access(addr);
   mem[addr / 4] = data;
 }
 
-enum {
-  FUNCTION = 0x00,
-  J        = 0x02,
-  JAL      = 0x03,
-  BEQ      = 0x04,
-  BNE      = 0x05,
-  ADDIU    = 0x09,
-  ANDI     = 0x0C,
-  LUI      = 0x0F,
-  TRAP     = 0x1A,
-  LW       = 0x23,
-  SW       = 0x2B
-};
-
-enum {
-  SLL  = 0x00,
-  SRA  = 0x03,
-  JR   = 0x08,
-  MFHI = 0x10,
-  MFLO = 0x12,
-  MULT = 0x18,
-  DIV  = 0x1A,
-  ADDU = 0x21,
-  SUBU = 0x23,
-  SLT  = 0x2a
-};
-
 enum {
   NEWLINE = 0x00,
   PRINT   = 0x01,
@@ -102,71 +281,896 @@ enum instruction_type {
   J_TYPE = 3
 };
 
-enum instruction_type itype (int opcode)
-{
-  static const enum instruction_type lookup [] = {
-    [FUNCTION] = R_TYPE,
-    [J]        = J_TYPE,
-    [JAL]      = J_TYPE,
-    [BEQ]      = I_TYPE,
-    [BNE]      = I_TYPE,
-    [ADDIU]    = I_TYPE,
-    [ANDI]     = I_TYPE,
-    [LUI]      = I_TYPE,
-    [TRAP]     = J_TYPE,
-    [LW]       = I_TYPE,
-    [SW]       = I_TYPE
+enum instruction_type itype (int op)
+{
+  static const enum instruction_type lookup [MIPS_OPS] = {
+    [MIPS_SLL]   = R_TYPE,
+    [MIPS_SRA]   = R_TYPE,
+    [MIPS_JR]    = R_TYPE,
+    [MIPS_MFHI]  = R_TYPE,
+    [MIPS_MFLO]  = R_TYPE,
+    [MIPS_MULT]  = R_TYPE,
+    [MIPS_DIV]   = R_TYPE,
+    [MIPS_ADDU]  = R_TYPE,
+    [MIPS_SUBU]  = R_TYPE,
+    [MIPS_SLT]   = R_TYPE,
+    [MIPS_J]     = J_TYPE,
+    [MIPS_JAL]   = J_TYPE,
+    [MIPS_BEQ]   = I_TYPE,
+    [MIPS_BNE]   = I_TYPE,
+    [MIPS_ADDIU] = I_TYPE,
+    [MIPS_ANDI]  = I_TYPE,
+    [MIPS_LUI]   = I_TYPE,
+    [MIPS_TRAP]  = J_TYPE,
+    [MIPS_LW]    = I_TYPE,
+    [MIPS_SW]    = I_TYPE
   };
 
-  assert (opcode < (int) ARRAYLEN (lookup));
-  return lookup [opcode];
+  assert (op < (int) ARRAYLEN (lookup));
+  return lookup [op];
 }
 
-int icycles (int opcode)
+int icycles (int op)
 {
-  static const int lookup [] = {
-    [J]     = 2,
-    [JAL]   = 2,
+  static const int lookup [MIPS_OPS] = {
+    [MIPS_SLL]   = 2,
+    [MIPS_SRA]   = 2,
+    [MIPS_JR]    = 2,
+    [MIPS_MFHI]  = 3,
+    [MIPS_MFLO]  = 3,
+    [MIPS_MULT]  = 32,
+    [MIPS_DIV]   = 32,
+    [MIPS_ADDU]  = 1,
+    [MIPS_SUBU]  = 1,
+    [MIPS_SLT]   = 1,
+
+    [MIPS_J]     = 2,
+    [MIPS_JAL]   = 2,
 
     // N.B.: These two instructions delay for three cycles when the branch
     // condition is met. This must be accounted for externally.
-    [BEQ]   = 1,
-    [BNE]   = 1,
-
-    [ADDIU] = 1,
-    [ANDI]  = 1,
-    [LUI]   = 1,
-    [TRAP]  = 3,
-    [LW]    = 8,
-    [SW]    = 8
+    [MIPS_BEQ]   = 1,
+    [MIPS_BNE]   = 1,
+
+    [MIPS_ADDIU] = 1,
+    [MIPS_ANDI]  = 1,
+    [MIPS_LUI]   = 1,
+    [MIPS_TRAP]  = 3,
+    [MIPS_LW]    = 8,
+    [MIPS_SW]    = 8
   };
 
-  assert (opcode < (int) ARRAYLEN (lookup));
-  return lookup [opcode];
+  assert (op < (int) ARRAYLEN (lookup));
+  return lookup [op];
 }
 
-int fcycles (int function)
+static void Histogram(const integer *distance)
+/* Prints how far ahead each input was produced, as a share of the reads that
+   had a producer, and the running total, which is the share of inputs a
+   forwarding network reaching that far back would cover */
 {
-  static const int lookup [] = {
-    [SLL]  = 2,
-    [SRA]  = 2,
-    [JR]   = 2,
-    [MFHI] = 3,
-    [MFLO] = 3,
-    [MULT] = 32,
-    [DIV]  = 32,
-    [ADDU] = 1,
-    [SUBU] = 1,
-    [SLT]  = 1
-  };
+  integer total = 0, sum = 0;
+  char label [16];
+  int d;
+
+  for (d = 1; d <= depth + 1; d++) {
+    total += distance [d];
+  }
+  printf ("\ndependency distance (%"PR_INTEGER" reads with a producer):\n", total);
+  printf ("%10s %12s %8s %11s\n", "distance", "reads", "percent", "cumulative");
+  for (d = 1; d <= depth + 1; d++) {
+    sum += distance [d];
+    if (distance [d] == 0) continue;
+    snprintf (label, sizeof (label), d <= depth ? "%d" : ">%d", d <= depth ? d : depth);
+    printf ("%10s %12"PR_INTEGER" %7.2f%% %10.2f%%\n", label, distance [d],
+            100.0 * distance [d] / total, 100.0 * sum / total);
+  }
+}
+
+static void LoadModels(const char *file)
+{
+  char line [1024], *key, *value, *end;
+  double (*row)[FEATURES] = NULL, cycles;
+  int capacity = 0, n, f, m;
+  FILE *in = fopen (file, "r");
+
+  if (in == NULL) {fprintf (stderr, "error: could not open file %s\n", file); exit (-1);}
+  for (n = 1; fgets (line, sizeof (line), in) != NULL; n++) {
+    if ((end = strchr (line, '#')) != NULL) *end = '\0';
+    key = strtok (line, " \t\r\n");
+    if (key == NULL) continue;
+    if (models == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      row = (double (*)[FEATURES]) realloc (row, capacity * sizeof (*row));
+      model_name = (char (*)[32]) realloc (model_name, capacity * sizeof (*model_name));
+      if (row == NULL || model_name == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+    }
+    snprintf (model_name [models], sizeof (*model_name), "%s", key);
+    for (f = 0; f < MIPS_OPS; f++) {
+      row [models][f] = icycles (f);
+    }
+    row [models][TAKEN] = 2;
+    while ((key = strtok (NULL, " \t\r\n")) != NULL) {
+      value = strchr (key, '=');
+      if (value == NULL) {fprintf (stderr, "error: %s:%d: expected name=cycles\n", file, n); exit (-1);}
+      *value++ = '\0';
+      cycles = strtod (value, &end);
+      if (end == value || *end != '\0') {fprintf (stderr, "error: %s:%d: bad cycles for %s\n", file, n, key); exit (-1);}
+      for (f = 1; f < MIPS_OPS && strcmp (key, mips_desc [f].mnemonic) != 0; f++) ;
+      if (strcmp (key, "taken") == 0) f = TAKEN;
+      else if (f == MIPS_OPS) {fprintf (stderr, "error: %s:%d: unknown instruction %s\n", file, n, key); exit (-1);}
+      row [models][f] = cycles;
+    }
+    models++;
+  }
+  fclose (in);
+
+  model_weight = (double *) malloc ((size_t) FEATURES * (models ? models : 1) * sizeof (double));
+  if (model_weight == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (f = 0; f < FEATURES; f++) {
+    for (m = 0; m < models; m++) {
+      model_weight [f * models + m] = row [m][f];
+    }
+  }
+  free (row);
+}
+
+/* Dataflow limit (-l windows). Each instruction starts once its register and
+ * memory inputs are ready and finishes its latency later; branches cost only
+ * their own latency, as if always predicted. The latest finish is the
+ * critical path of the run. With a window of W instructions, instruction i
+ * also waits until instruction i - W has retired, in order. Ready times are
+ * kept per register and per word of data memory, separately for each window,
+ * so no graph is ever built. Latencies are icycles, or those of the first
+ * -c model. */
+#define DATAFLOW_MAX 8
+
+struct dataflow {
+  int window;                // 0 for unlimited
+  int slot;                  // next in retired
+  integer ready [33];        // per register, HILO last
+  integer *memory;           // per word of data memory
+  integer *retired;          // [window], the last W retirements
+  integer last_retired, path;
+};
+
+static struct dataflow dataflow [DATAFLOW_MAX];
+static int dataflows;
+static integer latency [MIPS_OPS];
+
+static void ParseWindows(char *list)
+{
+  char *w;
+
+  dataflows = 1;  // unlimited
+  for (w = strtok (list, ","); w != NULL; w = strtok (NULL, ",")) {
+    if (dataflows == DATAFLOW_MAX) {fprintf (stderr, "error: at most %d windows\n", DATAFLOW_MAX - 1); exit (-1);}
+    if ((dataflow [dataflows].window = atoi (w)) < 1) {fprintf (stderr, "error: bad window %s\n", w); exit (-1);}
+    dataflows++;
+  }
+}
+
+static void InitDataflow(void)
+{
+  int k, op;
+
+  for (op = 0; op < MIPS_OPS; op++) {
+    latency [op] = models ? (integer) (model_weight [op * models] + 0.5) : icycles (op);
+  }
+  for (k = 0; k < dataflows; k++) {
+    dataflow [k].memory = (integer *) calloc (MEMSIZE / 4, sizeof (integer));
+    dataflow [k].retired = (integer *) calloc (dataflow [k].window ? dataflow [k].window : 1, sizeof (integer));
+    if (dataflow [k].memory == NULL || dataflow [k].retired == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  }
+}
+
+static void Flow(struct dataflow *df, const struct mips_insn *in, int word)
+/* Schedules one instruction; `word' indexes data memory for lw and sw */
+{
+  const struct mips_desc *d = &mips_desc [in->op];
+  integer start = 0, finish;
+
+  #define AFTER(T) if ((T) > start) start = (T)
+  if (d->reads & MIPS_USE_RS) AFTER (df->ready [in->rs]);
+  if (d->reads & MIPS_USE_RT) AFTER (df->ready [in->rt]);
+  if (d->reads & MIPS_USE_HILO) AFTER (df->ready [HILO]);
+  if (d->reads & MIPS_USE_MEM) AFTER (df->memory [word]);
+  if (df->window) AFTER (df->retired [df->slot]);
+  #undef AFTER
+  finish = start + latency [in->op];
+
+  if (d->writes & MIPS_USE_RD) df->ready [in->rd] = finish;
+  if (d->writes & MIPS_USE_RT) df->ready [in->rt] = finish;
+  if (d->writes & MIPS_USE_HILO) df->ready [HILO] = finish;
+  if (d->writes & MIPS_USE_RA) df->ready [31] = finish;
+  if (d->writes & MIPS_USE_MEM) df->memory [word] = finish;
+  df->ready [0] = 0;
+
+  if (finish > df->path) df->path = finish;
+  if (df->window) {
+    if (finish > df->last_retired) df->last_retired = finish;
+    df->retired [df->slot] = df->last_retired;
+    if (++df->slot == df->window) df->slot = 0;
+  }
+}
+
+static void Dataflow(integer count, integer cycles)
+{
+  int k;
+
+  printf ("\ndataflow limit (%s latencies, %"PR_INTEGER" cycles in order):\n", models ? model_name [0] : "icycles", cycles);
+  printf ("%10s %14s %8s\n", "window", "critical path", "IPC");
+  for (k = 0; k < dataflows; k++) {
+    if (dataflow [k].window) printf ("%10d", dataflow [k].window);
+    else printf ("%10s", "unlimited");
+    printf (" %14"PR_INTEGER" %8.2f\n", dataflow [k].path, dataflow [k].path ? (double) count / dataflow [k].path : 0.0);
+    free (dataflow [k].memory);
+    free (dataflow [k].retired);
+  }
+}
+
+static void Costs(const integer *op_counts, integer taken, integer count)
+/* Prints every model's cycle total and CPI for this run */
+{
+  double x [FEATURES], *total = (double *) calloc (models ? models : 1, sizeof (double));
+  const double *w;
+  int f, m;
+
+  if (total == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (f = 0; f < MIPS_OPS; f++) {
+    x [f] = op_counts [f];
+  }
+  x [TAKEN] = taken;
+  for (f = 0; f < FEATURES; f++) {
+    w = model_weight + f * models;
+    for (m = 0; m < models; m++) {
+      total [m] += w [m] * x [f];
+    }
+  }
+
+  printf ("\ncost models:\n");
+  printf ("%-20s %16s %8s\n", "model", "cycles", "CPI");
+  for (m = 0; m < models; m++) {
+    printf ("%-20s %16.0f %8.3f\n", model_name [m], total [m], total [m] / count);
+  }
+  free (total);
+}
+
+static void EndInterval(integer length)
+/* Saves the vector counted since the last interval and clears it */
+{
+  int k;
+
+  if (intervals + 1 >= intervals_capacity) {
+    intervals_capacity = intervals_capacity ? 2 * intervals_capacity : 1024;
+    first_pair = (size_t *) realloc (first_pair, (intervals_capacity + 1) * sizeof (*first_pair));
+    interval_length = (integer *) realloc (interval_length, intervals_capacity * sizeof (*interval_length));
+    if (first_pair == NULL || interval_length == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  }
+  if (npairs + ntouched > pairs_capacity) {
+    while (npairs + ntouched > pairs_capacity)
+      pairs_capacity = pairs_capacity ? 2 * pairs_capacity : 65536;
+    pairs = (struct bbv_pair *) realloc (pairs, pairs_capacity * sizeof (*pairs));
+    if (pairs == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  }
+  first_pair [intervals] = npairs;
+  for (k = 0; k < ntouched; k++) {
+    pairs [npairs].block = touched [k];
+    pairs [npairs].count = bbv [touched [k]];
+    npairs++;
+    bbv [touched [k]] = 0;
+  }
+  interval_length [intervals++] = length;
+  first_pair [intervals] = npairs;
+  ntouched = 0;
+}
+
+static double Projection(uint32_t block, int dim)
+/* A fixed pseudo-random entry in [-1, 1) of the projection matrix */
+{
+  uint64_t z = ((uint64_t) block * BBV_DIMS + dim + 1) * 0x9e3779b97f4a7c15ULL;
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (2.0 / 9007199254740992.0) - 1;
+}
+
+static double Distance(const double *a, const double *b)
+{
+  double sum = 0;
+  int d;
+
+  for (d = 0; d < BBV_DIMS; d++) {
+    sum += (a [d] - b [d]) * (a [d] - b [d]);
+  }
+  return sum;
+}
+
+static int ByStart(const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+static void SimPoints(integer count)
+{
+  double (*x)[BBV_DIMS], (*centroid)[BBV_DIMS], *best, d, weight, total;
+  int *cluster, *size, *point, k, i, j, c, changed, iteration, points;
+  integer *start;
+  uint64_t rng = 3339;
+  size_t p;
+  FILE *f;
+
+  if (bbv_file != NULL) {
+    f = fopen (bbv_file, "w");
+    if (f == NULL) {fprintf (stderr, "error: could not open file %s\n", bbv_file); exit (-1);}
+    for (i = 0; i < intervals; i++) {
+      fprintf (f, "T");
+      for (p = first_pair [i]; p < first_pair [i + 1]; p++) {
+        fprintf (f, ":%"PRIu32":%"PRIu32" ", pairs [p].block + 1, pairs [p].count);
+      }
+      fprintf (f, "\n");
+    }
+    fclose (f);
+  }
+
+  k = clusters < intervals ? clusters : intervals;
+  x = (double (*)[BBV_DIMS]) calloc (intervals, sizeof (*x));
+  centroid = (double (*)[BBV_DIMS]) calloc (k, sizeof (*centroid));
+  best = (double *) malloc (intervals * sizeof (double));
+  cluster = (int *) malloc (intervals * sizeof (int));
+  size = (int *) calloc (k, sizeof (int));
+  point = (int *) malloc (k * sizeof (int));
+  start = (integer *) malloc (intervals * sizeof (integer));
+  if (x == NULL || centroid == NULL || best == NULL || cluster == NULL || size == NULL || point == NULL || start == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+
+  // Project each vector, normalized to the interval's length
+  for (i = 0; i < intervals; i++) {
+    start [i] = i == 0 ? 0 : start [i - 1] + interval_length [i - 1];
+    for (p = first_pair [i]; p < first_pair [i + 1]; p++) {
+      for (j = 0; j < BBV_DIMS; j++) {
+        x [i][j] += Projection (pairs [p].block, j) * pairs [p].count / interval_length [i];
+      }
+    }
+  }
+
+  // k-means++ seeding, then Lloyd's iterations
+  #define NEXT_RANDOM() (rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17)
+  memcpy (centroid [0], x [NEXT_RANDOM () % intervals], sizeof (*x));
+  for (i = 0; i < intervals; i++) {
+    best [i] = Distance (x [i], centroid [0]);
+  }
+  for (c = 1; c < k; c++) {
+    for (total = 0, i = 0; i < intervals; i++) {
+      total += best [i];
+    }
+    d = (NEXT_RANDOM () >> 11) * (1.0 / 9007199254740992.0) * total;
+    for (i = 0; i < intervals - 1 && (d -= best [i]) > 0; i++) ;
+    memcpy (centroid [c], x [i], sizeof (*x));
+    for (i = 0; i < intervals; i++) {
+      best [i] = fmin (best [i], Distance (x [i], centroid [c]));
+    }
+  }
+  #undef NEXT_RANDOM
+  for (i = 0; i < intervals; i++) {
+    cluster [i] = -1;
+  }
+  for (iteration = 0, changed = 1; changed && iteration < 100; iteration++) {
+    changed = 0;
+    for (i = 0; i < intervals; i++) {
+      for (c = 0, j = 0; j < k; j++) {
+        if (Distance (x [i], centroid [j]) < Distance (x [i], centroid [c])) c = j;
+      }
+      changed |= cluster [i] != c;
+      cluster [i] = c;
+    }
+    memset (centroid, 0, k * sizeof (*centroid));
+    memset (size, 0, k * sizeof (int));
+    for (i = 0; i < intervals; i++) {
+      size [cluster [i]]++;
+      for (j = 0; j < BBV_DIMS; j++) {
+        centroid [cluster [i]][j] += x [i][j];
+      }
+    }
+    for (c = 0; c < k; c++) {
+      for (j = 0; j < BBV_DIMS && size [c] > 0; j++) {
+        centroid [c][j] /= size [c];
+      }
+    }
+  }
+
+  // The interval nearest each centroid represents its cluster
+  for (c = 0; c < k; c++) {
+    point [c] = -1;
+  }
+  for (i = 0; i < intervals; i++) {
+    c = cluster [i];
+    d = Distance (x [i], centroid [c]);
+    if (point [c] < 0 || d < best [c]) {
+      point [c] = i;
+      best [c] = d;
+    }
+  }
+  for (points = 0, c = 0; c < k; c++) {
+    if (point [c] >= 0) point [points++] = point [c];
+  }
+  qsort (point, points, sizeof (int), ByStart);
+
+  f = NULL;
+  if (region_file != NULL) {
+    f = fopen (region_file, "w");
+    if (f == NULL) {fprintf (stderr, "error: could not open file %s\n", region_file); exit (-1);}
+    fprintf (f, "# simulation points: interval %d, %d intervals, %d clusters\n", interval, intervals, points);
+    fprintf (f, "instructions %"PR_INTEGER"\n", count);
+  }
+  printf ("\nsimulation points (interval %d, %d intervals, %d clusters):\n", interval, intervals, points);
+  printf ("%12s %12s %8s\n", "start", "end", "weight");
+  for (j = 0; j < points; j++) {
+    i = point [j];
+    for (weight = 0, c = 0; c < intervals; c++) {
+      if (cluster [c] == cluster [i]) weight += interval_length [c];
+    }
+    weight /= count;
+    printf ("%12"PR_INTEGER" %12"PR_INTEGER" %8.4f\n", start [i], start [i] + interval_length [i], weight);
+    if (f != NULL) fprintf (f, "%"PR_INTEGER" %"PR_INTEGER" %.6f\n", start [i], start [i] + interval_length [i], weight);
+  }
+  if (f != NULL && fclose (f) != 0) {fprintf (stderr, "error: could not write %s\n", region_file); exit (-1);}
+
+  free (x); free (centroid); free (best); free (cluster); free (size); free (point); free (start);
+}
+
+static int ByCycles(const void *a, const void *b)
+{
+  const struct profile *x = &profile [*(const int *) a], *y = &profile [*(const int *) b];
+
+  return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : *(const int *) a - *(const int *) b;
+}
+
+static void Hotspots(integer cycles)
+/* Prints the instructions that were charged the most cycles, hottest first */
+{
+  int *order = (int *) malloc (icount * sizeof (int));
+  char text [64];
+  struct mips_insn in;
+  int i, n;
+
+  if (order == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (i = 0; i < icount; i++) {
+    order [i] = i;
+  }
+  qsort (order, icount, sizeof (int), ByCycles);
+
+  printf ("\nhot spots (by cycles charged; stalls are inputs produced by the previous instruction):\n");
+  printf ("%8s %12s %12s %7s %10s %10s  %s\n", "pc", "count", "cycles", "share", "taken", "stalls", "instruction");
+  for (n = 0; n < hotspots && n < icount && profile [order [n]].count != 0; n++) {
+    const struct profile *p = &profile [order [n]];
+    in = mips_decode (instruction [order [n]], TEXT + 4 * order [n]);
+    mips_format (text, sizeof (text), &in, 0);
+    printf ("%8x %12"PR_INTEGER" %12"PR_INTEGER" %6.2f%% %10"PR_INTEGER" %10"PR_INTEGER"  %s\n",
+            in.pc, p->count, p->cycles, 100.0 * p->cycles / cycles, p->taken, p->stalls, text);
+  }
+  free (order);
+}
+
+/* Instruction sequences (-g k). The last three ops are kept packed five bits
+ * apiece, so bigram and trigram counts are indexed by the packed value
+ * directly: with fewer than 32 ops that is a perfect hash, and functs are
+ * told apart because the ops are. A sequence runs from after one jump or
+ * branch through the next; each is counted by its start and length in a
+ * fixed-size open-addressed table. At exit the k largest of each are printed,
+ * sequences with their mnemonics. */
+#define SEQUENCE_TABLE 65536  // a power of two
+
+struct sequence {
+  uint32_t start, length;  // start indexes instruction; length 0 is free
+  integer count;
+};
+
+static int top_sequences;
+static integer *bigrams, *trigrams;  // [1 << 10], [1 << 15]
+static struct sequence *sequences;
+static integer sequences_dropped;    // executions that found the table full
+
+static void Sequence(uint32_t start, uint32_t length)
+{
+  uint32_t h = (start * 0x9e3779b1u ^ length * 0x85ebca6bu) & (SEQUENCE_TABLE - 1);
+  int probes;
+
+  for (probes = 0; probes < SEQUENCE_TABLE; probes++, h = (h + 1) & (SEQUENCE_TABLE - 1)) {
+    if (sequences [h].start == start && sequences [h].length == length) {
+      sequences [h].count++;
+      return;
+    }
+    if (sequences [h].length == 0) {
+      sequences [h].start = start;
+      sequences [h].length = length;
+      sequences [h].count = 1;
+      return;
+    }
+  }
+  sequences_dropped++;
+}
+
+static int ByCount(const void *a, const void *b)
+{
+  const integer x = *(const integer *) a, y = *(const integer *) b;
 
-  assert (function < (int) ARRAYLEN (lookup));
-  return lookup [function];
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int BySequenceCount(const void *a, const void *b)
+{
+  const struct sequence *x = (const struct sequence *) a, *y = (const struct sequence *) b;
+
+  return x->count < y->count ? 1 : x->count > y->count ? -1 : (int) x->start - (int) y->start;
+}
+
+static void Grams(const char *title, const integer *counts, int n, int length, integer total)
+/* Prints the k most frequent of n packed n-grams */
+{
+  integer (*top)[2] = (integer (*)[2]) malloc (n * sizeof (*top));
+  int i, j, used = 0;
+
+  if (top == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (i = 0; i < n; i++) {
+    if (counts [i] == 0) continue;
+    top [used][0] = counts [i];
+    top [used++][1] = i;
+  }
+  qsort (top, used, sizeof (*top), ByCount);
+  printf ("\n%s (%d distinct):\n", title, used);
+  for (i = 0; i < top_sequences && i < used; i++) {
+    printf ("%12"PR_INTEGER" %6.2f%%  ", top [i][0], 100.0 * top [i][0] / total);
+    for (j = length - 1; j >= 0; j--) {
+      printf (" %s", mips_desc [(top [i][1] >> (5 * j)) & 31].mnemonic);
+    }
+    printf ("\n");
+  }
+  free (top);
+}
+
+static void Sequences(integer count)
+{
+  struct sequence *top = (struct sequence *) malloc (SEQUENCE_TABLE * sizeof (*top));
+  uint32_t k;
+  int i, used = 0;
+
+  if (top == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  Grams ("opcode bigrams", bigrams, 1 << 10, 2, count - 1);
+  Grams ("opcode trigrams", trigrams, 1 << 15, 3, count - 2);
+
+  for (i = 0; i < SEQUENCE_TABLE; i++) {
+    if (sequences [i].length != 0) top [used++] = sequences [i];
+  }
+  qsort (top, used, sizeof (*top), BySequenceCount);
+  printf ("\ninstruction sequences between branches (%d distinct", used);
+  if (sequences_dropped) printf (", %"PR_INTEGER" executions not counted: table full", sequences_dropped);
+  printf ("):\n%12s %7s %8s %6s  %s\n", "count", "share", "pc", "length", "instructions");
+  for (i = 0; i < top_sequences && i < used; i++) {
+    printf ("%12"PR_INTEGER" %6.2f%% %8x %6"PRIu32" ", top [i].count,
+            100.0 * top [i].count * top [i].length / count, TEXT + 4 * top [i].start, top [i].length);
+    for (k = 0; k < top [i].length && k < 12; k++) {
+      printf (" %s", mips_desc [mips_decode (instruction [top [i].start + k], 0).op].mnemonic);
+    }
+    printf ("%s\n", k < top [i].length ? " ..." : "");
+  }
+  free (top);
+  free (bigrams);
+  free (trigrams);
+  free (sequences);
+}
+
+/* Branch behaviour (-j lines). For every static beq and bne: executions,
+ * taken branches, transitions between taken and not taken, and the misses of
+ * a two-bit counter of its own, which is what a cheap predictor gets at best.
+ * Runs of one outcome are measured as they end, in log2 buckets; the runs of
+ * a branch's usual outcome are its trip counts when it closes or exits a
+ * loop. At exit each branch is classified:
+ *
+ *   always, never  one outcome only
+ *   loop           the other outcome never twice in a row, and at least half
+ *                  of the runs as long as the one before
+ *   biased         90% or more one way
+ *   data           anything else, data-dependent */
+#define RUN_BUCKETS 16
+
+struct branch {
+  integer count, taken, transitions, misses;
+  integer runs [2][RUN_BUCKETS];    // ended runs of not taken [0], taken [1]
+  integer repeats [2];              // ended runs as long as the previous one
+  integer run, last_run [2];
+  uint8_t last, counter;            // last outcome; two-bit counter
+};
+
+enum {ALWAYS, NEVER, LOOP, BIASED, DATA, BRANCH_CLASSES};
+static const char *branch_class [] = {"always", "never", "loop", "biased", "data"};
+
+static int branch_lines;
+static struct branch *branches;     // [icount]
+
+static void EndRun(struct branch *b)
+{
+  int o = b->last, bucket = ReuseBucket (b->run) - 1;
+
+  b->runs [o][bucket < RUN_BUCKETS ? bucket : RUN_BUCKETS - 1]++;
+  b->repeats [o] += b->run == b->last_run [o];
+  b->last_run [o] = b->run;
+}
+
+static void Branch(struct branch *b, int outcome)
+{
+  b->misses += (b->counter >= 2) != outcome;
+  if (outcome) {
+    if (b->counter < 3) b->counter++;
+  } else if (b->counter > 0) {
+    b->counter--;
+  }
+  if (b->count > 0 && outcome != b->last) {
+    b->transitions++;
+    EndRun (b);
+    b->run = 0;
+  }
+  b->run++;
+  b->last = outcome;
+  b->count++;
+  b->taken += outcome;
+}
+
+static int Classify(const struct branch *b)
+{
+  int usual = 2 * b->taken >= b->count, other = !usual, k;
+  integer ended = 0, long_other = 0;
+
+  if (b->taken == b->count) return ALWAYS;
+  if (b->taken == 0) return NEVER;
+  for (k = 0; k < RUN_BUCKETS; k++) {
+    ended += b->runs [usual][k];
+    if (k > 0) long_other += b->runs [other][k];
+  }
+  if (long_other == 0 && ended >= 2 && 2 * b->repeats [usual] >= ended) return LOOP;
+  if (10 * (usual ? b->taken : b->count - b->taken) >= 9 * b->count) return BIASED;
+  return DATA;
+}
+
+static int ByExecutions(const void *a, const void *b)
+{
+  const struct branch *x = &branches [*(const int *) a], *y = &branches [*(const int *) b];
+
+  return x->count < y->count ? 1 : x->count > y->count ? -1 : *(const int *) a - *(const int *) b;
+}
+
+static void Branches(void)
+{
+  integer count [BRANCH_CLASSES] = {0}, executed [BRANCH_CLASSES] = {0}, misses [BRANCH_CLASSES] = {0};
+  integer taken [BRANCH_CLASSES] = {0};
+  int *order = (int *) malloc (icount * sizeof (int));
+  int i, n = 0, c, k, usual;
+  struct branch *b;
+
+  if (order == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (i = 0; i < icount; i++) {
+    b = &branches [i];
+    if (b->count == 0) continue;
+    if (b->run > 0) EndRun (b);  // the run still open at exit counts too
+    b->run = 0;
+    c = Classify (b);
+    count [c]++;
+    executed [c] += b->count;
+    taken [c] += b->taken;
+    misses [c] += b->misses;
+    order [n++] = i;
+  }
+  qsort (order, n, sizeof (int), ByExecutions);
+
+  printf ("\nbranches (%d executed, two-bit counter per branch):\n", n);
+  printf ("%8s %9s %14s %7s %8s\n", "class", "branches", "executions", "taken", "misses");
+  for (c = 0; c < BRANCH_CLASSES; c++) {
+    if (count [c] == 0) continue;
+    printf ("%8s %9"PR_INTEGER" %14"PR_INTEGER" %6.1f%% %7.2f%%\n", branch_class [c], count [c], executed [c],
+            100.0 * taken [c] / executed [c], 100.0 * misses [c] / executed [c]);
+  }
+  printf ("\n%8s %12s %7s %7s %7s %7s  %s\n", "pc", "count", "taken", "flips", "misses", "class", "runs of the usual outcome (1, 2-3, 4-7, ...)");
+  for (i = 0; i < branch_lines && i < n; i++) {
+    b = &branches [order [i]];
+    c = Classify (b);
+    usual = 2 * b->taken >= b->count;
+    printf ("%8x %12"PR_INTEGER" %6.1f%% %6.1f%% %6.1f%% %7s ", TEXT + 4 * order [i], b->count,
+            100.0 * b->taken / b->count, 100.0 * b->transitions / b->count, 100.0 * b->misses / b->count, branch_class [c]);
+    for (k = RUN_BUCKETS - 1; k > 0 && b->runs [usual][k] == 0; k--) ;
+    for (c = 0; c <= k; c++) {
+      printf ("%s%"PR_INTEGER, c ? "/" : " ", b->runs [usual][c]);
+    }
+    printf ("\n");
+  }
+  free (order);
+  free (branches);
+}
+
+/* Register pressure (-a). The control-flow graph is recovered from the
+ * branch and jump targets: jal goes to its callee, and jr to every return
+ * site, the instruction after each jal. Liveness is solved over it per
+ * instruction, as bitmasks with HILO in bit 32; while running, the registers
+ * live into each executed instruction are counted. Loads whose base is $sp or
+ * $fp and whose word was last stored in the same activation of the same
+ * function are reloads, traffic that a register would have saved. Each jal
+ * starts a new activation and each jr ends one. */
+struct liveness {
+  uint64_t use, def, in, out;
+  int succ [2];             // -1 for none; RETURN for every return site
+};
+
+#define RETURN (-2)
+
+static int pressure;
+static struct liveness *live;    // [icount]
+static integer live_counts [34]; // instructions by registers live into them
+static integer stack_loads, stack_stores, reloads;
+static int *frame;               // activation per word of data memory, 0 for none
+static int *frames, frame_depth, frame_capacity, next_frame = 1;
+static int cfg_blocks, cfg_passes;
+
+static void Liveness(void)
+{
+  int i, k, changed, passes;
+  unsigned char *leader;
+  uint64_t returned;
+  struct mips_insn in;
+
+  live = (struct liveness *) calloc (icount, sizeof (*live));
+  frame = (int *) calloc (MEMSIZE / 4, sizeof (int));
+  frame_capacity = 256;
+  frames = (int *) malloc (frame_capacity * sizeof (int));
+  if (live == NULL || frame == NULL || frames == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  frames [0] = next_frame++;
+
+  for (i = 0; i < icount; i++) {
+    const struct mips_desc *d;
+    struct liveness *l = &live [i];
+
+    in = mips_decode (instruction [i], TEXT + 4 * i);
+    d = &mips_desc [in.op];
+    if (d->reads & MIPS_USE_RS) l->use |= 1ull << in.rs;
+    if (d->reads & MIPS_USE_RT) l->use |= 1ull << in.rt;
+    if (d->reads & MIPS_USE_HILO) l->use |= 1ull << HILO;
+    if (d->writes & MIPS_USE_RD) l->def |= 1ull << in.rd;
+    if (d->writes & MIPS_USE_RT) l->def |= 1ull << in.rt;
+    if (d->writes & MIPS_USE_HILO) l->def |= 1ull << HILO;
+    if (d->writes & MIPS_USE_RA) l->def |= 1ull << 31;
+    if (in.op == MIPS_TRAP && (in.addr & 0xf) == PRINT) l->use |= 1ull << in.rs;
+    if (in.op == MIPS_TRAP && (in.addr & 0xf) == PROMPT) l->def |= 1ull << in.rt;
+    l->use &= ~1ull;
+    l->def &= ~1ull;
+
+    // A target outside the text, below it included, is no edge
+    k = (int) ((in.target - TEXT) >> 2);
+    l->succ [0] = l->succ [1] = -1;
+    switch (in.op) {
+      case MIPS_BEQ:
+      case MIPS_BNE:
+        l->succ [1] = (unsigned) k < (unsigned) icount ? k : -1;
+        l->succ [0] = i + 1 < icount ? i + 1 : -1;
+        break;
+      case MIPS_J:
+      case MIPS_JAL:
+        l->succ [0] = (unsigned) k < (unsigned) icount ? k : -1;
+        break;
+      case MIPS_JR:
+        l->succ [0] = RETURN;
+        break;
+      case MIPS_INVALID:
+      case MIPS_SYSCALL:
+        break;
+      case MIPS_TRAP:
+        if ((in.addr & 0xf) == STOP) break;
+        // fall through
+      default:
+        l->succ [0] = i + 1 < icount ? i + 1 : -1;
+    }
+  }
+
+  // Backwards, so that most of a pass sees its successors' latest sets
+  for (passes = 1, changed = 1; changed; passes++) {
+    changed = 0;
+    for (returned = 0, i = 1; i < icount; i++) {
+      if (mips_decode (instruction [i - 1], 0).op == MIPS_JAL) returned |= live [i].in;
+    }
+    for (i = icount - 1; i >= 0; i--) {
+      struct liveness *l = &live [i];
+      uint64_t out = 0, in_;
+
+      for (k = 0; k < 2; k++) {
+        if (l->succ [k] == RETURN) out |= returned;
+        else if (l->succ [k] >= 0) out |= live [l->succ [k]].in;
+      }
+      in_ = l->use | (out & ~l->def);
+      changed |= out != l->out || in_ != l->in;
+      l->out = out;
+      l->in = in_;
+    }
+  }
+
+  // A block starts at a target or after anything that does not fall through
+  leader = (unsigned char *) calloc (icount + 1, 1);
+  if (leader == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  for (leader [0] = 1, i = 0; i < icount; i++) {
+    for (k = 0; k < 2; k++) {
+      if (live [i].succ [k] >= 0 && live [i].succ [k] != i + 1) leader [live [i].succ [k]] = 1;
+    }
+    if (live [i].succ [0] != i + 1 || live [i].succ [1] != -1) leader [i + 1] = 1;
+  }
+  for (i = 0; i < icount; i++) {
+    cfg_blocks += leader [i];
+  }
+  cfg_passes = passes - 1;
+  free (leader);
+}
+
+static int Popcount(uint64_t x)
+{
+  int n = 0;
+
+  for (; x != 0; x &= x - 1) {
+    n++;
+  }
+  return n;
+}
+
+static void Frames(const struct mips_insn *in, int base, int word)
+/* Follows activations and stack-frame traffic for one executed instruction */
+{
+  if (in->op == MIPS_JAL) {
+    if (++frame_depth == frame_capacity) {
+      frame_capacity *= 2;
+      frames = (int *) realloc (frames, frame_capacity * sizeof (int));
+      if (frames == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+    }
+    frames [frame_depth] = next_frame++;
+  } else if (in->op == MIPS_JR) {
+    if (frame_depth > 0) frame_depth--;
+  } else if ((in->op == MIPS_LW || in->op == MIPS_SW) && (base == 29 || base == 30)) {
+    if (in->op == MIPS_SW) {
+      stack_stores++;
+      frame [word] = frames [frame_depth];
+    } else {
+      stack_loads++;
+      reloads += frame [word] == frames [frame_depth];
+    }
+  }
+}
+
+static void Pressure(integer count, integer loads)
+{
+  int i, n, most = 0, registers;
+  uint64_t ever = 0;
+  integer sum = 0;
+
+  for (i = 0; i < icount; i++) {
+    n = Popcount (live [i].in);
+    if (n > most) most = n;
+    ever |= live [i].use | live [i].def;
+  }
+  registers = Popcount (ever);
+  printf ("\nregister pressure (%d blocks, liveness in %d passes; %d registers used, at most %d live at once):\n",
+          cfg_blocks, cfg_passes, registers, most);
+  printf ("%6s %12s %8s\n", "live", "instructions", "share");
+  for (i = 0; i < 34; i++) {
+    sum += i * live_counts [i];
+    if (live_counts [i] != 0) printf ("%6d %12"PR_INTEGER" %7.2f%%\n", i, live_counts [i], 100.0 * live_counts [i] / count);
+  }
+  printf ("mean live registers per instruction: %.2f\n", (double) sum / count);
+  printf ("stack-frame loads: %"PR_INTEGER" (%.1f%% of loads), stores: %"PR_INTEGER"\n",
+          stack_loads, loads ? 100.0 * stack_loads / loads : 0.0, stack_stores);
+  printf ("reloads of values stored in the same frame: %"PR_INTEGER" (%.1f%% of loads, %.1f%% of instructions)\n",
+          reloads, loads ? 100.0 * reloads / loads : 0.0, 100.0 * reloads / count);
+  free (live);
+  free (frame);
+  free (frames);
 }
 
 static void Interpret(int start)
 {
-  register int instr, opcode, rs, rt, rd, shamt, funct, uimm, simm, addr, jaddr, baddr;
+  register int instr, rs, rt, rd, shamt, uimm, simm, addr;
+  struct mips_insn in;
   register int pc, hi = 0, lo = 0;
   int reg[32];
   register int cont = 1;
@@ -183,31 +1187,43 @@ static void Interpret(int start)
     0  // J-type
   };
 
-  // Which registers we have written to over the last three instructions. [1]
-  // was one instruction ago, [3] was three ago, and [0] is what we're writing
-  // this instruction. The value of any element is the register's index. -1 is a
-  // special value for the multiplication/division register(s).
-  int write_record [4] = {0, 0, 0, 0};
-  integer one_ago = 0;
-  integer two_ago = 0;
-  integer three_ago = 0;
-
-  // Shift the write-record for the new cycle. Only use this once, and do it
-  // before any register usage.
-  #define UPDATE_WREC() (write_record [3] = write_record [2], \
-                         write_record [2] = write_record [1], \
-                         write_record [1] = write_record [0], \
-                         write_record [0] = 0)
-
-  // Do the write-record comparisons in the else-clause of the first comparison
-  // rather than doing them after so we don't count reads from $zero as being
-  // dependent on writes to $zero. Similarly, only count the most recent write
-  // to a given register. Don't put side-effects in REG.
+  // The number of the instruction that last wrote each register, or 0 if none
+  // has. -1 is a special value for the multiplication/division register(s),
+  // which are kept in slot HILO. A read's dependency distance is then one
+  // subtraction however far back its producer was; distance [d] counts the
+  // reads whose input was produced d instructions ahead, with everything
+  // beyond `depth' in distance [depth + 1].
+  integer last_write [33] = {0};
+  integer *distance = (integer *) calloc (depth + 2, sizeof (integer));
+  integer d, before;
+  integer op_counts [MIPS_OPS] = {0};
+  integer taken = 0;
+  integer interval_end = interval ? interval : -1;
+  integer window_end = window ? window : -1;
+  struct profile *prof;
+  int block = 0, leader = 1, word = 0, k;
+  uint32_t history = 0, sequence_start = 0, sequence_length = 0;
+
+  if (distance == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+
+  mips_interval_column (&interval_log, "R-type", &itype_counts [R_TYPE]);
+  mips_interval_column (&interval_log, "I-type", &itype_counts [I_TYPE]);
+  mips_interval_column (&interval_log, "J-type", &itype_counts [J_TYPE]);
+  mips_interval_column (&interval_log, "lw", &op_counts [MIPS_LW]);
+  mips_interval_column (&interval_log, "sw", &op_counts [MIPS_SW]);
+  mips_interval_column (&interval_log, "beq", &op_counts [MIPS_BEQ]);
+  mips_interval_column (&interval_log, "bne", &op_counts [MIPS_BNE]);
+  mips_interval_column (&interval_log, "taken", &taken);
+  mips_interval_column (&interval_log, "cycles", &cycles);
+
+  // Reads from $zero are counted apart rather than as dependent on writes to
+  // $zero. Don't put side-effects in REG.
+  #define SLOT(REG) ((REG) < 0 ? HILO : (REG))
   #define RREAD(REG) (REG == 0 ? ++zero_reads : \
-                      (REG == write_record [1] ? ++one_ago : \
-                       (REG == write_record [2] ? ++two_ago : \
-                        (REG == write_record [3] ? ++three_ago : 0))))
-  #define RWRITE(REG) (write_record [0] = REG)
+                      (last_write [SLOT (REG)] != 0 ? \
+                       (d = count - last_write [SLOT (REG)], prof->stalls += d == 1, \
+                        ++distance [d <= depth ? d : depth + 1]) : 0))
+  #define RWRITE(REG) (last_write [SLOT (REG)] = count)
 
   pc = start;
   reg[28] = 0x10008000;  // gp
@@ -216,161 +1232,155 @@ static void Interpret(int start)
   while (cont) {
     count++;
     instr = Fetch(pc);
+    prof = &profile [(pc - TEXT) >> 2];
+    before = cycles;
     pc += 4;
     reg[0] = 0;  // $zero
-    UPDATE_WREC ();
-
-    opcode = (unsigned)instr >> 26;
-    rs = (instr >> 21) & 0x1f;
-    rt = (instr >> 16) & 0x1f;
-    rd = (instr >> 11) & 0x1f;
-    shamt = (instr >> 6) & 0x1f;
-    funct = instr & 0x3f;
-    uimm = instr & 0xffff;
-    simm = ((signed)uimm << 16) >> 16;
-    addr = instr & 0x3ffffff;
-    jaddr = (pc & 0xf0000000) + addr * 4;
-    baddr = pc + simm * 4;
+
+    in = mips_decode (instr, pc - 4);
+    rs = in.rs;
+    rt = in.rt;
+    rd = in.rd;
+    shamt = in.shamt;
+    uimm = in.uimm;
+    simm = in.simm;
+    addr = in.addr;
+    if ((dataflows || pressure) && (in.op == MIPS_LW || in.op == MIPS_SW)) word = (reg [rs] + simm - 0x10000000) >> 2;
 
     // The macros RREAD and RWRITE are provided for the purpose of marking a
     // register as being read and written by an instruction, respectively. Avoid
     // side effects in these macro calls, and sequence all calls to RREAD before
     // calls to RWRITE for any instruction. Remember, these are C macros, not
     // Lisp macros.
-    switch (opcode)
+    switch (in.op)
     {
-      case FUNCTION:
-        switch (funct)
-        {
-          case SLL:
-            reg [rd] = reg [rs] << shamt;
-            RREAD (rs);
-            RWRITE (rd);
-            break;
-
-          case SRA:
-            reg [rd] = reg [rs] >> shamt;
-            RREAD (rs);
-            RWRITE (rd);
-            break;
+      case MIPS_SLL:
+        reg [rd] = reg [rs] << shamt;
+        RREAD (rs);
+        RWRITE (rd);
+        break;
 
-          case JR:
-            pc = reg [rs];
-            RREAD (rs);
-            break;
+      case MIPS_SRA:
+        reg [rd] = reg [rs] >> shamt;
+        RREAD (rs);
+        RWRITE (rd);
+        break;
 
-          case MFHI:
-            reg [rd] = hi;
-            RREAD (-1);
-            RWRITE (rd);
-            break;
+      case MIPS_JR:
+        pc = reg [rs];
+        RREAD (rs);
+        break;
 
-          case MFLO:
-            reg [rd] = lo;
-            RREAD (-1);
-            RWRITE (rd);
-            break;
+      case MIPS_MFHI:
+        reg [rd] = hi;
+        RREAD (-1);
+        RWRITE (rd);
+        break;
 
-          case MULT:
-            wide = reg [rs] * reg [rt];
-            lo = wide & 0xffffffff;
-            hi = wide >> 32;
-            RREAD (rs);
-            RREAD (rt);
-            RWRITE (-1);
-            break;
+      case MIPS_MFLO:
+        reg [rd] = lo;
+        RREAD (-1);
+        RWRITE (rd);
+        break;
 
-          case DIV:
-            if (reg [rt] == 0)
-            {
-              fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
-              cont = 0;
-            }
-            else
-            {
-              lo = reg [rs] / reg [rt];
-              hi = reg [rs] % reg [rt];
-            }
-            RREAD (rs);
-            RREAD (rt);
-            RWRITE (-1);
-            break;
+      case MIPS_MULT:
+        wide = reg [rs] * reg [rt];
+        lo = wide & 0xffffffff;
+        hi = wide >> 32;
+        RREAD (rs);
+        RREAD (rt);
+        RWRITE (-1);
+        break;
 
-          case ADDU:
-            reg [rd] = reg [rs] + reg [rt];
-            RREAD (rs);
-            RREAD (rt);
-            RWRITE (rd);
-            break;
+      case MIPS_DIV:
+        if (reg [rt] == 0)
+        {
+          fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
+          cont = 0;
+        }
+        else
+        {
+          lo = reg [rs] / reg [rt];
+          hi = reg [rs] % reg [rt];
+        }
+        RREAD (rs);
+        RREAD (rt);
+        RWRITE (-1);
+        break;
 
-          case SUBU:
-            reg [rd] = reg [rs] - reg [rt];
-            RREAD (rs);
-            RREAD (rt);
-            RWRITE (rd);
-            break;
+      case MIPS_ADDU:
+        reg [rd] = reg [rs] + reg [rt];
+        RREAD (rs);
+        RREAD (rt);
+        RWRITE (rd);
+        break;
 
-          case SLT:
-            reg [rd] = (reg [rs] < reg [rt] ? 1 : 0);
-            RREAD (rs);
-            RREAD (rt);
-            RWRITE (rd);
-            break;
+      case MIPS_SUBU:
+        reg [rd] = reg [rs] - reg [rt];
+        RREAD (rs);
+        RREAD (rt);
+        RWRITE (rd);
+        break;
 
-          default:
-            fprintf (stderr, "unimplemented instruction: pc = 0x%x\n", pc-4);
-            cont = 0;
-        }
+      case MIPS_SLT:
+        reg [rd] = (reg [rs] < reg [rt] ? 1 : 0);
+        RREAD (rs);
+        RREAD (rt);
+        RWRITE (rd);
         break;
 
-      case J:
-        pc = jaddr;
+      case MIPS_J:
+        pc = in.target;
         break;
 
-      case JAL:
+      case MIPS_JAL:
         reg [31] = pc;
-        pc = jaddr;
+        pc = in.target;
         RWRITE (31);
         break;
 
-      case BEQ:
+      case MIPS_BEQ:
         if (reg [rs] == reg [rt])
         {
-          pc = baddr;
+          pc = in.target;
           cycles += 2; // 2-cycle penalty if branch is taken
+          ++prof->taken;
+          ++taken;
         }
         RREAD (rs);
         RREAD (rt);
         break;
 
-      case BNE:
+      case MIPS_BNE:
         if (reg [rs] != reg [rt])
         {
-          pc = baddr;
+          pc = in.target;
           cycles += 2; // See above
+          ++prof->taken;
+          ++taken;
         }
         RREAD (rs);
         RREAD (rt);
         break;
 
-      case ADDIU:
+      case MIPS_ADDIU:
         reg [rt] = reg [rs] + simm;
         RREAD (rs);
         RWRITE (rt);
         break;
 
-      case ANDI:
+      case MIPS_ANDI:
         reg [rt] = reg [rs] & uimm;
         RREAD (rs);
         RWRITE (rt);
         break;
 
-      case LUI:
+      case MIPS_LUI:
         reg [rt] = simm << 16;
         RWRITE (rt);
         break;
 
-      case TRAP:
+      case MIPS_TRAP:
         switch (addr & 0xf)
         {
           case NEWLINE:
@@ -399,13 +1409,13 @@ static void Interpret(int start)
         }
         break;
 
-      case LW:
+      case MIPS_LW:
         reg [rt] = LoadWord (reg [rs] + simm);
         RREAD (rs);
         RWRITE (rt);
         break;
 
-      case SW:
+      case MIPS_SW:
         StoreWord (reg [rt], reg [rs] + simm);
         RREAD (rs);
         RREAD (rt);
@@ -416,12 +1426,55 @@ static void Interpret(int start)
         cont = 0;
     }
 
-    ++itype_counts [itype (opcode)];
-    if (opcode == FUNCTION)
-      cycles += fcycles (funct);
-    else
-      cycles += icycles (opcode);
+    ++itype_counts [itype (in.op)];
+    ++op_counts [in.op];
+
+    if (interval) {
+      // A block starts after every jump or branch, taken or not
+      if (leader) block = prof - profile;
+      if (bbv [block]++ == 0) touched [ntouched++] = block;
+      leader = in.op == MIPS_J || in.op == MIPS_JAL || in.op == MIPS_JR || in.op == MIPS_BEQ || in.op == MIPS_BNE;
+      if (count == interval_end) {
+        EndInterval (interval);
+        interval_end += interval;
+      }
+    }
+
+    if (pressure) {
+      ++live_counts [Popcount (live [prof - profile].in)];
+      Frames (&in, rs, word);
+    }
+
+    if (branch_lines && (in.op == MIPS_BEQ || in.op == MIPS_BNE)) {
+      // Branches write no registers, so the condition can be evaluated again
+      Branch (&branches [prof - profile], (reg [rs] == reg [rt]) == (in.op == MIPS_BEQ));
+    }
+
+    if (top_sequences) {
+      history = (history << 5 | in.op) & 0x7fff;
+      if (count >= 2) ++bigrams [history & 0x3ff];
+      if (count >= 3) ++trigrams [history];
+      if (sequence_length++ == 0) sequence_start = prof - profile;
+      if (in.op == MIPS_J || in.op == MIPS_JAL || in.op == MIPS_JR || in.op == MIPS_BEQ || in.op == MIPS_BNE || !cont) {
+        Sequence (sequence_start, sequence_length);
+        sequence_length = 0;
+      }
+    }
+
+    if (count == window_end) {
+      EndWindow ();
+      window_end += window;
+    }
+
+    cycles += icycles (in.op);
+    prof->count++;
+    prof->cycles += cycles - before;
+    mips_interval_at (&interval_log, count);
+    for (k = 0; k < dataflows; k++) {
+      Flow (&dataflow [k], &in, word);
+    }
   }
+  mips_interval_close (&interval_log, count);
 
   assert (itype_counts [0] == 0);
 
@@ -434,16 +1487,103 @@ static void Interpret(int start)
   printf ("number of inputs produced 1 instructions ahead: %"PR_INTEGER"\n"
           "number of inputs produced 2 instructions ahead: %"PR_INTEGER"\n"
           "number of inputs produced 3 instructions ahead: %"PR_INTEGER"\n",
-          one_ago, two_ago, three_ago);
+          distance [1], distance [2], distance [3]);
+  if (histogram) Histogram (distance);
+  if (hotspots) Hotspots (cycles);
+  if (models) Costs (op_counts, taken, count);
+  if (interval) {
+    if (ntouched > 0) EndInterval (count - (interval_end - interval));
+    SimPoints (count);
+  }
+  if (block_bits) Locality ();
+  if (dataflows) Dataflow (count, cycles);
+  if (top_sequences) Sequences (count);
+  if (branch_lines) Branches ();
+  if (pressure) Pressure (count, op_counts [MIPS_LW]);
+  free (distance);
 }
 
 int main(int argc, char *argv[])
 {
   int c, start;
   FILE *f;
+  const char *log_file = NULL;
+  int log_every = 100000;
+  const char *usage = "usage: %s [-d depth] [-p lines] [-c models] [-i interval [-k clusters] [-r regions] [-v bbv]] [-b block] [-w window] [-o log [-n instructions]] [-l windows] [-g top] [-j lines] [-a] executable\n";
 
   printf("CS3339 MIPS Interpreter\n");
-  if (argc != 2) {fprintf(stderr, "usage: %s executable\n", argv[0]); exit(-1);}
+  mips_interval_none(&interval_log);
+  while ((c = getopt(argc, argv, "d:p:c:i:k:r:v:b:w:o:n:l:g:j:a")) != -1) {
+    switch (c) {
+      case 'd':
+        depth = atoi(optarg);
+        if (depth < 3) depth = 3;
+        histogram = 1;
+        break;
+      case 'p':
+        hotspots = atoi(optarg);
+        break;
+      case 'c':
+        LoadModels(optarg);
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'k':
+        clusters = atoi(optarg);
+        if (clusters < 1) clusters = 1;
+        break;
+      case 'r':
+        region_file = optarg;
+        break;
+      case 'v':
+        bbv_file = optarg;
+        break;
+      case 'b':
+        block_size = atoi(optarg);
+        reuse = 1;
+        break;
+      case 'w':
+        window = atoi(optarg);
+        if (window < 1) window = 0;
+        break;
+      case 'l':
+        ParseWindows(optarg);
+        break;
+      case 'a':
+        pressure = 1;
+        break;
+      case 'j':
+        branch_lines = atoi(optarg);
+        if (branch_lines < 0) branch_lines = 0;
+        break;
+      case 'g':
+        top_sequences = atoi(optarg);
+        if (top_sequences < 0) top_sequences = 0;
+        break;
+      case 'o':
+        log_file = optarg;
+        break;
+      case 'n':
+        log_every = atoi(optarg);
+        if (log_every < 0) log_every = 0;
+        break;
+      default:
+        fprintf(stderr, usage, argv[0]);
+        exit(-1);
+    }
+  }
+  if (argc - optind != 1) {fprintf(stderr, usage, argv[0]); exit(-1);}
+  if (dataflows) InitDataflow();
+  if (top_sequences) {
+    assert(MIPS_OPS <= 32);
+    bigrams = (integer *)(calloc(1 << 10, sizeof(integer)));
+    trigrams = (integer *)(calloc(1 << 15, sizeof(integer)));
+    sequences = (struct sequence *)(calloc(SEQUENCE_TABLE, sizeof(struct sequence)));
+    if (bigrams == NULL || trigrams == NULL || sequences == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  if (log_file != NULL) mips_interval_open(&interval_log, log_file, log_every);
+  argv += optind - 1;
   if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
   if (sizeof(long long) != 8) {fprintf(stderr, "error: need 8-byte long longs\n"); exit(-1);}
 
@@ -472,10 +1612,44 @@ int main(int argc, char *argv[])
       instruction[c] = Convert(instruction[c]);
     }
   }
+  profile = (struct profile *)(calloc(icount, sizeof(*profile)));
+  if (profile == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  if (pressure) Liveness();
+  if (branch_lines) {
+    branches = (struct branch *)(calloc(icount, sizeof(struct branch)));
+    if (branches == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  }
+  if (interval > 0) {
+    bbv = (uint32_t *)(calloc(icount, sizeof(*bbv)));
+    touched = (int *)(malloc(icount * sizeof(*touched)));
+    if (bbv == NULL || touched == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+  } else {
+    interval = 0;
+  }
+  if (reuse || window) {
+    if (block_size == 0) block_size = 4;
+    for (block_bits = 2; (1 << block_bits) < block_size && block_bits < 20; block_bits++) ;
+    if (block_size != 1 << block_bits) {fprintf(stderr, "error: block size must be a power of two from 4 to %d\n", MEMSIZE); exit(-1);}
+    blocks = MEMSIZE >> block_bits;
+    if (window) {
+      window_stamp = (int *)(calloc(blocks, sizeof(int)));
+      if (window_stamp == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+    }
+    if (reuse) {
+      // Twice the blocks, so that renumbering at least halves the clock
+      clock_capacity = 2 * blocks;
+      last_use = (int *)(calloc(blocks, sizeof(int)));
+      fenwick = (int *)(calloc(clock_capacity + 1, sizeof(int)));
+      owner = (int *)(malloc((clock_capacity + 1) * sizeof(int)));
+      reuse_counts = (integer *)(calloc(ReuseBucket(blocks) + 1, sizeof(integer)));
+      if (last_use == NULL || fenwick == NULL || owner == NULL || reuse_counts == NULL) {fprintf(stderr, "error: out of memory\n"); exit(-1);}
+    }
+  }
 
   printf("running %s\n\n", argv[1]);
   Interpret(start);
 
+  free (profile);
   free (instruction);
   return 0;
 }
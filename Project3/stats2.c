@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #if __STDC_VERSION__ < 199901L
 # warning "This program should be compiled as C99 or better"
 #endif
@@ -7,6 +9,10 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <unistd.h>
+
+#include "../common/mips.h"
+#include "../common/interval.h"
 
 #define MEMSIZE 1048576
 #define ARRAYLEN(NAME) (sizeof (NAME) / sizeof (*NAME))
@@ -16,6 +22,7 @@ typedef int_least64_t integer;
 
 static int little_endian, icount, *instruction;
 static int mem[MEMSIZE / 4];
+static struct mips_interval interval_log;  // -o; see common/interval.h
 
 static int Convert(unsigned int x)
 {
@@ -60,33 +67,6 @@ static void StoreWord(int data, int addr)
 	mem[addr / 4] = data;
 }
 
-enum {
-	FUNCTION = 0x00,
-	J        = 0x02,
-	JAL      = 0x03,
-	BEQ      = 0x04,
-	BNE      = 0x05,
-	ADDIU    = 0x09,
-	ANDI     = 0x0C,
-	LUI      = 0x0F,
-	TRAP     = 0x1A,
-	LW       = 0x23,
-	SW       = 0x2B
-};
-
-enum {
-	SLL  = 0x00,
-	SRA  = 0x03,
-	JR   = 0x08,
-	MFHI = 0x10,
-	MFLO = 0x12,
-	MULT = 0x18,
-	DIV  = 0x1A,
-	ADDU = 0x21,
-	SUBU = 0x23,
-	SLT  = 0x2a
-};
-
 enum {
 	NEWLINE = 0x00,
 	PRINT   = 0x01,
@@ -100,71 +80,73 @@ enum instruction_type {
 	J_TYPE = 3
 };
 
-enum instruction_type itype (int opcode)
+enum instruction_type itype (int op)
 {
-	static const enum instruction_type lookup [] = {
-		[FUNCTION] = R_TYPE,
-		[J]        = J_TYPE,
-		[JAL]      = J_TYPE,
-		[BEQ]      = I_TYPE,
-		[BNE]      = I_TYPE,
-		[ADDIU]    = I_TYPE,
-		[ANDI]     = I_TYPE,
-		[LUI]      = I_TYPE,
-		[TRAP]     = J_TYPE,
-		[LW]       = I_TYPE,
-		[SW]       = I_TYPE
+	static const enum instruction_type lookup [MIPS_OPS] = {
+		[MIPS_SLL]   = R_TYPE,
+		[MIPS_SRA]   = R_TYPE,
+		[MIPS_JR]    = R_TYPE,
+		[MIPS_MFHI]  = R_TYPE,
+		[MIPS_MFLO]  = R_TYPE,
+		[MIPS_MULT]  = R_TYPE,
+		[MIPS_DIV]   = R_TYPE,
+		[MIPS_ADDU]  = R_TYPE,
+		[MIPS_SUBU]  = R_TYPE,
+		[MIPS_SLT]   = R_TYPE,
+		[MIPS_J]     = J_TYPE,
+		[MIPS_JAL]   = J_TYPE,
+		[MIPS_BEQ]   = I_TYPE,
+		[MIPS_BNE]   = I_TYPE,
+		[MIPS_ADDIU] = I_TYPE,
+		[MIPS_ANDI]  = I_TYPE,
+		[MIPS_LUI]   = I_TYPE,
+		[MIPS_TRAP]  = J_TYPE,
+		[MIPS_LW]    = I_TYPE,
+		[MIPS_SW]    = I_TYPE
 	};
 
-	assert (opcode < (int) ARRAYLEN (lookup));
-	return lookup [opcode];
+	assert (op < (int) ARRAYLEN (lookup));
+	return lookup [op];
 }
 
-int icycles (int opcode)
+int icycles (int op)
 {
-	static const int lookup [] = {
-		[J]     = 2,
-		[JAL]   = 2,
+	static const int lookup [MIPS_OPS] = {
+		[MIPS_SLL]   = 2,
+		[MIPS_SRA]   = 2,
+		[MIPS_JR]    = 2,
+		[MIPS_MFHI]  = 3,
+		[MIPS_MFLO]  = 3,
+		[MIPS_MULT]  = 32,
+		[MIPS_DIV]   = 32,
+		[MIPS_ADDU]  = 1,
+		[MIPS_SUBU]  = 1,
+		[MIPS_SLT]   = 1,
+
+		[MIPS_J]     = 2,
+		[MIPS_JAL]   = 2,
 
 		// N.B.: These two instructions delay for three cycles when the branch
 		// condition is met. This must be accounted for externally.
-		[BEQ]   = 1,
-		[BNE]   = 1,
-
-		[ADDIU] = 1,
-		[ANDI]  = 1,
-		[LUI]   = 1,
-		[TRAP]  = 3,
-		[LW]    = 8,
-		[SW]    = 8
-	};
-
-	assert (opcode < (int) ARRAYLEN (lookup));
-	return lookup [opcode];
-}
-
-int fcycles (int function)
-{
-	static const int lookup [] = {
-		[SLL]  = 2,
-		[SRA]  = 2,
-		[JR]   = 2,
-		[MFHI] = 3,
-		[MFLO] = 3,
-		[MULT] = 32,
-		[DIV]  = 32,
-		[ADDU] = 1,
-		[SUBU] = 1,
-		[SLT]  = 1
+		[MIPS_BEQ]   = 1,
+		[MIPS_BNE]   = 1,
+
+		[MIPS_ADDIU] = 1,
+		[MIPS_ANDI]  = 1,
+		[MIPS_LUI]   = 1,
+		[MIPS_TRAP]  = 3,
+		[MIPS_LW]    = 8,
+		[MIPS_SW]    = 8
 	};
 
-	assert (function < (int) ARRAYLEN (lookup));
-	return lookup [function];
+	assert (op < (int) ARRAYLEN (lookup));
+	return lookup [op];
 }
 
 static void Interpret(int start)
 {
-	register int instr, opcode, rs, rt, rd, shamt, funct, uimm, simm, addr, jaddr, baddr;
+	register int instr, rs, rt, rd, shamt, uimm, simm, addr;
+	struct mips_insn in;
 	register int pc, hi = 0, lo = 0;
 	int reg[32];
 	register int cont = 1;
@@ -207,6 +189,15 @@ static void Interpret(int start)
                               (REG == write_record [3] ? ++three_ago : 0))))
 	#define RWRITE(REG) (write_record [0] = REG)
 
+	mips_interval_column (&interval_log, "R-type", &itype_counts [R_TYPE]);
+	mips_interval_column (&interval_log, "I-type", &itype_counts [I_TYPE]);
+	mips_interval_column (&interval_log, "J-type", &itype_counts [J_TYPE]);
+	mips_interval_column (&interval_log, "zero_reads", &zero_reads);
+	mips_interval_column (&interval_log, "1_ahead", &one_ago);
+	mips_interval_column (&interval_log, "2_ahead", &two_ago);
+	mips_interval_column (&interval_log, "3_ahead", &three_ago);
+	mips_interval_column (&interval_log, "cycles", &cycles);
+
 	pc = start;
 	reg[28] = 0x10008000;  // gp
 	reg[29] = 0x10000000 + MEMSIZE;  // sp
@@ -218,157 +209,145 @@ static void Interpret(int start)
 		reg[0] = 0;  // $zero
 		UPDATE_WREC ();
 
-		opcode = (unsigned)instr >> 26;
-		rs = (instr >> 21) & 0x1f;
-		rt = (instr >> 16) & 0x1f;
-		rd = (instr >> 11) & 0x1f;
-		shamt = (instr >> 6) & 0x1f;
-		funct = instr & 0x3f;
-		uimm = instr & 0xffff;
-		simm = ((signed)uimm << 16) >> 16;
-		addr = instr & 0x3ffffff;
-		jaddr = (pc & 0xf0000000) + addr * 4;
-		baddr = pc + simm * 4;
+		in = mips_decode (instr, pc - 4);
+		rs = in.rs;
+		rt = in.rt;
+		rd = in.rd;
+		shamt = in.shamt;
+		uimm = in.uimm;
+		simm = in.simm;
+		addr = in.addr;
 
 		// The macros RREAD and RWRITE are provided for the purpose of marking a
 		// register as being read and written by an instruction, respectively. Avoid
 		// side effects in these macro calls, and sequence all calls to RREAD before
 		// calls to RWRITE for any instruction. Remember, these are C macros, not
 		// Lisp macros.
-		switch (opcode)
+		switch (in.op)
 		{
-		case FUNCTION:
-			switch (funct)
-			{
-			case SLL:
-				reg [rd] = reg [rs] << shamt;
-				RREAD (rs);
-				RWRITE (rd);
-				break;
-
-			case SRA:
-				reg [rd] = reg [rs] >> shamt;
-				RREAD (rs);
-				RWRITE (rd);
-				break;
+		case MIPS_SLL:
+			reg [rd] = reg [rs] << shamt;
+			RREAD (rs);
+			RWRITE (rd);
+			break;
 
-			case JR:
-				pc = reg [rs];
-				RREAD (rs);
-				break;
+		case MIPS_SRA:
+			reg [rd] = reg [rs] >> shamt;
+			RREAD (rs);
+			RWRITE (rd);
+			break;
 
-			case MFHI:
-				reg [rd] = hi;
-				RREAD (-1);
-				RWRITE (rd);
-				break;
+		case MIPS_JR:
+			pc = reg [rs];
+			RREAD (rs);
+			break;
 
-			case MFLO:
-				reg [rd] = lo;
-				RREAD (-1);
-				RWRITE (rd);
-				break;
+		case MIPS_MFHI:
+			reg [rd] = hi;
+			RREAD (-1);
+			RWRITE (rd);
+			break;
 
-			case MULT:
-				wide = reg [rs] * reg [rt];
-				lo = wide & 0xffffffff;
-				hi = wide >> 32;
-				RREAD (rs);
-				RREAD (rt);
-				RWRITE (-1);
-				break;
+		case MIPS_MFLO:
+			reg [rd] = lo;
+			RREAD (-1);
+			RWRITE (rd);
+			break;
 
-			case DIV:
-				if (reg [rt] == 0)
-				{
-					fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
-					cont = 0;
-				}
-				else
-				{
-					lo = reg [rs] / reg [rt];
-					hi = reg [rs] % reg [rt];
-				}
-				RREAD (rs);
-				RREAD (rt);
-				RWRITE (-1);
-				break;
+		case MIPS_MULT:
+			wide = reg [rs] * reg [rt];
+			lo = wide & 0xffffffff;
+			hi = wide >> 32;
+			RREAD (rs);
+			RREAD (rt);
+			RWRITE (-1);
+			break;
 
-			case ADDU:
-				reg [rd] = reg [rs] + reg [rt];
-				RREAD (rs);
-				RREAD (rt);
-				RWRITE (rd);
-				break;
+		case MIPS_DIV:
+			if (reg [rt] == 0)
+			{
+				fprintf (stderr, "division by zero: pc = 0x%x\n", pc-4);
+				cont = 0;
+			}
+			else
+			{
+				lo = reg [rs] / reg [rt];
+				hi = reg [rs] % reg [rt];
+			}
+			RREAD (rs);
+			RREAD (rt);
+			RWRITE (-1);
+			break;
 
-			case SUBU:
-				reg [rd] = reg [rs] - reg [rt];
-				RREAD (rs);
-				RREAD (rt);
-				RWRITE (rd);
-				break;
+		case MIPS_ADDU:
+			reg [rd] = reg [rs] + reg [rt];
+			RREAD (rs);
+			RREAD (rt);
+			RWRITE (rd);
+			break;
 
-			case SLT:
-				reg [rd] = (reg [rs] < reg [rt] ? 1 : 0);
-				RREAD (rs);
-				RREAD (rt);
-				RWRITE (rd);
-				break;
+		case MIPS_SUBU:
+			reg [rd] = reg [rs] - reg [rt];
+			RREAD (rs);
+			RREAD (rt);
+			RWRITE (rd);
+			break;
 
-			default:
-				fprintf (stderr, "unimplemented instruction: pc = 0x%x\n", pc-4);
-				cont = 0;
-			}
+		case MIPS_SLT:
+			reg [rd] = (reg [rs] < reg [rt] ? 1 : 0);
+			RREAD (rs);
+			RREAD (rt);
+			RWRITE (rd);
 			break;
 
-		case J:
-			pc = jaddr;
+		case MIPS_J:
+			pc = in.target;
 			break;
 
-		case JAL:
+		case MIPS_JAL:
 			reg [31] = pc;
-			pc = jaddr;
+			pc = in.target;
 			RWRITE (31);
 			break;
 
-		case BEQ:
+		case MIPS_BEQ:
 			if (reg [rs] == reg [rt])
 			{
-				pc = baddr;
+				pc = in.target;
 				cycles += 2; // 2-cycle penalty if branch is taken
 			}
 			RREAD (rs);
 			RREAD (rt);
 			break;
 
-		case BNE:
+		case MIPS_BNE:
 			if (reg [rs] != reg [rt])
 			{
-				pc = baddr;
+				pc = in.target;
 				cycles += 2; // See above
 			}
 			RREAD (rs);
 			RREAD (rt);
 			break;
 
-		case ADDIU:
+		case MIPS_ADDIU:
 			reg [rt] = reg [rs] + simm;
 			RREAD (rs);
 			RWRITE (rt);
 			break;
 
-		case ANDI:
+		case MIPS_ANDI:
 			reg [rt] = reg [rs] & uimm;
 			RREAD (rs);
 			RWRITE (rt);
 			break;
 
-		case LUI:
+		case MIPS_LUI:
 			reg [rt] = simm << 16;
 			RWRITE (rt);
 			break;
 
-		case TRAP:
+		case MIPS_TRAP:
 			switch (addr & 0xf)
 			{
 			case NEWLINE:
@@ -397,13 +376,13 @@ static void Interpret(int start)
 			}
 			break;
 
-		case LW:
+		case MIPS_LW:
 			reg [rt] = LoadWord (reg [rs] + simm);
 			RREAD (rs);
 			RWRITE (rt);
 			break;
 
-		case SW:
+		case MIPS_SW:
 			StoreWord (reg [rt], reg [rs] + simm);
 			RREAD (rs);
 			RREAD (rt);
@@ -414,12 +393,12 @@ static void Interpret(int start)
 			cont = 0;
 		}
 
-		++itype_counts [itype (opcode)];
-		if (opcode == FUNCTION)
-			cycles += fcycles (funct);
-		else
-			cycles += icycles (opcode);
+		++itype_counts [itype (in.op)];
+
+		cycles += icycles (in.op);
+		mips_interval_at (&interval_log, count);
 	}
+	mips_interval_close (&interval_log, count);
 
 	assert (itype_counts [0] == 0);
 
@@ -439,9 +418,29 @@ int main(int argc, char *argv[])
 {
 	int c, start;
 	FILE *f;
+	const char *log_file = NULL;
+	int log_every = 100000;
+	const char *usage = "usage: %s [-o log [-n instructions]] executable\n";
 
 	printf("CS3339 MIPS Interpreter\n");
-	if (argc != 2) {fprintf(stderr, "usage: %s executable\n", argv[0]); exit(-1);}
+	mips_interval_none(&interval_log);
+	while ((c = getopt(argc, argv, "o:n:")) != -1) {
+		switch (c) {
+		case 'o':
+			log_file = optarg;
+			break;
+		case 'n':
+			log_every = atoi(optarg);
+			if (log_every < 0) log_every = 0;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			exit(-1);
+		}
+	}
+	if (argc - optind != 1) {fprintf(stderr, usage, argv[0]); exit(-1);}
+	if (log_file != NULL) mips_interval_open(&interval_log, log_file, log_every);
+	argv += optind - 1;
 	if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
 	if (sizeof(long long) != 8) {fprintf(stderr, "error: need 8-byte long longs\n"); exit(-1);}
 
@@ -1,5 +1,7 @@
 /* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; smart-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
 
+#define _POSIX_C_SOURCE 200809L
+
 #if __STDC_VERSION__ < 199901L
 # warning "This program should be compiled as C99 or better"
 #endif
@@ -10,8 +12,12 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "debug.h"
+#include "../common/mips.h"
+#include "../common/regions.h"
+#include "../common/interval.h"
 
 typedef intmax_t integer;
 #define PR_INTEGER PRIiMAX
@@ -43,6 +49,13 @@ enum {
 };
 
 static uint32_t icount, *instruction;
+
+// The pipeline is also what executes the program, so it runs everywhere; -r
+// only picks which stretches are counted, see common/regions.h
+static struct mips_regions regions;
+
+// -o log [-n instructions]: interval rows, see common/interval.h
+static struct mips_interval interval_log;
 static uint32_t mem [MEMSIZE / 4];
 
 
@@ -92,33 +105,6 @@ static void StoreWord(uint32_t data, uint32_t addr)
 
 
 
-enum opcode {
-  FUNCTION = 0x00,
-  J        = 0x02,
-  JAL      = 0x03,
-  BEQ      = 0x04,
-  BNE      = 0x05,
-  ADDIU    = 0x09,
-  ANDI     = 0x0C,
-  LUI      = 0x0F,
-  TRAP     = 0x1A,
-  LW       = 0x23,
-  SW       = 0x2B
-};
-
-enum funcode {
-  SLL  = 0x00,
-  SRA  = 0x03,
-  JR   = 0x08,
-  MFHI = 0x10,
-  MFLO = 0x12,
-  MULT = 0x18,
-  DIV  = 0x1A,
-  ADDU = 0x21,
-  SUBU = 0x23,
-  SLT  = 0x2a
-};
-
 enum trapcode {
   NEWLINE = 0x00,
   PRINT   = 0x01,
@@ -208,6 +194,13 @@ static void Interpret (uint32_t start)
   integer bubbles = 0;
   integer flushes = 0;
 
+  mips_regions_counter (&regions, &cycles);
+  mips_regions_counter (&regions, &bubbles);
+  mips_regions_counter (&regions, &flushes);
+  mips_interval_column (&interval_log, "cycles", &cycles);
+  mips_interval_column (&interval_log, "bubbles", &bubbles);
+  mips_interval_column (&interval_log, "flushes", &flushes);
+
   /// Control functions
   void DEBUG_STAGE (enum pipestage STAGE)
   {
@@ -290,10 +283,12 @@ static void Interpret (uint32_t start)
       reg [ZERO] = 0;
       pc += 4;
       pipeline_pc [IF1] = pc;
+      mips_regions_at (&regions, count);
+      mips_interval_at (&interval_log, count);
       ++count;
 
       // Special-case the STOP trap to avoid fetching inaccessible memory
-      if (bitrange (pipeline [IF1], 26, 32) == TRAP &&
+      if (mips_decode (pipeline [IF1], pc - 4).op == MIPS_TRAP &&
           (bitrange (pipeline [IF1], 0, 26) & 0xf) == STOP)
         cont = false;
     }
@@ -308,157 +303,145 @@ static void Interpret (uint32_t start)
     // ID operations
     uint32_t ID_instr = pipeline [ID];
     uint32_t ID_pc    = pipeline_pc [ID];
-    uint8_t  opcode   = bitrange (ID_instr, 26, 32);
-    uint8_t  rs       = bitrange (ID_instr, 21, 26);
-    uint8_t  rt       = bitrange (ID_instr, 16, 21);
-    uint8_t  rd       = bitrange (ID_instr, 11, 16);
-    uint8_t  shamt    = bitrange (ID_instr, 6, 11);
-    uint8_t  funct    = bitrange (ID_instr, 0, 6);
-    uint16_t uimm     = bitrange (ID_instr, 0, 16);
-    int16_t  simm     = sign_extend (uimm, 16);
-    uint32_t addr     = bitrange (ID_instr, 0, 26);
-    uint32_t jaddr    = (ID_pc & 0xf0000000) + addr * 4;
-    uint32_t baddr    = ID_pc + simm * 4;
+    const struct mips_insn in = mips_decode (ID_instr, ID_pc - 4);
+    uint8_t  rs       = in.rs;
+    uint8_t  rt       = in.rt;
+    uint8_t  rd       = in.rd;
+    uint8_t  shamt    = in.shamt;
+    uint16_t uimm     = in.uimm;
+    int16_t  simm     = in.simm;
+    uint32_t addr     = in.addr;
 
     // ID (via RREAD) through WB operations
-    switch (opcode)
+    switch (in.op)
     {
-      case FUNCTION:
-        switch (funct)
-        {
-          case SLL:
-            RREAD (EXE1, rs);
-            reg [rd] = reg [rs] << shamt;
-            RWRITE (MEM1, rd);
-            break;
-
-          case SRA:
-            RREAD (EXE1, rs);
-            reg [rd] = sign_extend (reg [rs] >> shamt, 32 - shamt);
-            RWRITE (MEM1, rd);
-            break;
+      case MIPS_SLL:
+        RREAD (EXE1, rs);
+        reg [rd] = reg [rs] << shamt;
+        RWRITE (MEM1, rd);
+        break;
 
-          case JR:
-            RREAD (ID, rs);
-            pc = reg [rs];
-            FLUSH (IF2);
-            FLUSH (IF1);
-            break;
+      case MIPS_SRA:
+        RREAD (EXE1, rs);
+        reg [rd] = sign_extend (reg [rs] >> shamt, 32 - shamt);
+        RWRITE (MEM1, rd);
+        break;
 
-          case MFHI:
-            RREAD (EXE1, HILO);
-            reg [rd] = hi;
-            RWRITE (EXE2, rd);
-            break;
+      case MIPS_JR:
+        RREAD (ID, rs);
+        pc = reg [rs];
+        FLUSH (IF2);
+        FLUSH (IF1);
+        break;
 
-          case MFLO:
-            RREAD (EXE1, HILO);
-            reg [rd] = lo;
-            RWRITE (EXE2, rd);
-            break;
+      case MIPS_MFHI:
+        RREAD (EXE1, HILO);
+        reg [rd] = hi;
+        RWRITE (EXE2, rd);
+        break;
 
-          case MULT:
-            RREAD (EXE1, rs);
-            RREAD (EXE1, rt);
-            uint64_t wide = reg [rs] * reg [rt];
-            lo = wide & 0xffffffff;
-            hi = wide >> 32;
-            RWRITE (WB2, HILO);
-            break;
+      case MIPS_MFLO:
+        RREAD (EXE1, HILO);
+        reg [rd] = lo;
+        RWRITE (EXE2, rd);
+        break;
 
-          case DIV:
-            RREAD (EXE1, rs);
-            RREAD (EXE1, rt);
-            if (reg [rt] == 0) {
-              fprintf (stderr, "division by zero: pc = 0x%"PRIx32"\n", pc - 4);
-              cont = false;
-            }
-            else {
-              lo = reg [rs] / reg [rt];
-              hi = reg [rs] % reg [rt];
-            }
-            RWRITE (WB2, HILO);
-            break;
+      case MIPS_MULT:
+        RREAD (EXE1, rs);
+        RREAD (EXE1, rt);
+        uint64_t wide = reg [rs] * reg [rt];
+        lo = wide & 0xffffffff;
+        hi = wide >> 32;
+        RWRITE (WB2, HILO);
+        break;
 
-          case ADDU:
-            RREAD (EXE1, rs);
-            RREAD (EXE1, rt);
-            reg [rd] = reg [rs] + reg [rt];
-            RWRITE (MEM1, rd);
-            break;
+      case MIPS_DIV:
+        RREAD (EXE1, rs);
+        RREAD (EXE1, rt);
+        if (reg [rt] == 0) {
+          fprintf (stderr, "division by zero: pc = 0x%"PRIx32"\n", pc - 4);
+          cont = false;
+        }
+        else {
+          lo = reg [rs] / reg [rt];
+          hi = reg [rs] % reg [rt];
+        }
+        RWRITE (WB2, HILO);
+        break;
 
-          case SUBU:
-            RREAD (EXE1, rs);
-            RREAD (EXE1, rt);
-            reg [rd] = reg [rs] - reg [rt];
-            RWRITE (MEM1, rd);
-            break;
+      case MIPS_ADDU:
+        RREAD (EXE1, rs);
+        RREAD (EXE1, rt);
+        reg [rd] = reg [rs] + reg [rt];
+        RWRITE (MEM1, rd);
+        break;
 
-          case SLT:
-            RREAD (EXE1, rs);
-            RREAD (EXE1, rt);
-            reg [rd] = ((int32_t) reg [rs] < (int32_t) reg [rt] ? 1 : 0);
-            RWRITE (MEM1, rd);
-            break;
+      case MIPS_SUBU:
+        RREAD (EXE1, rs);
+        RREAD (EXE1, rt);
+        reg [rd] = reg [rs] - reg [rt];
+        RWRITE (MEM1, rd);
+        break;
 
-          default:
-            fprintf (stderr, "unimplemented instruction: pc = 0x%"PRIx32"\n", pc - 4);
-            cont = false;
-        }
+      case MIPS_SLT:
+        RREAD (EXE1, rs);
+        RREAD (EXE1, rt);
+        reg [rd] = ((int32_t) reg [rs] < (int32_t) reg [rt] ? 1 : 0);
+        RWRITE (MEM1, rd);
         break;
 
-      case J:
-        pc = jaddr;
+      case MIPS_J:
+        pc = in.target;
         FLUSH (IF2);
         FLUSH (IF1);
         break;
 
-      case JAL:
+      case MIPS_JAL:
         reg [RA] = pc;
-        pc = jaddr;
+        pc = in.target;
         RWRITE (EXE1, RA);
         FLUSH ();
         FLUSH ();
         break;
 
-      case BEQ:
+      case MIPS_BEQ:
         RREAD (ID, rs);
         RREAD (ID, rt);
         if (reg [rs] == reg [rt]) {
-          pc = baddr;
+          pc = in.target;
           FLUSH (IF2);
           FLUSH (IF1);
         }
         break;
 
-      case BNE:
+      case MIPS_BNE:
         RREAD (ID, rs);
         RREAD (ID, rt);
         if (reg [rs] != reg [rt]) {
-          pc = baddr;
+          pc = in.target;
           FLUSH (IF2);
           FLUSH (IF1);
         }
         break;
 
-      case ADDIU:
+      case MIPS_ADDIU:
         RREAD (EXE1, rs);
         reg [rt] = reg [rs] + simm;
         RWRITE (MEM1, rt);
         break;
 
-      case ANDI:
+      case MIPS_ANDI:
         RREAD (EXE1, rs);
         reg [rt] = reg [rs] & uimm;
         RWRITE (EXE2, rt);
         break;
 
-      case LUI:
+      case MIPS_LUI:
         reg [rt] = uimm << 16;
         RWRITE (EXE2, rt);
         break;
 
-      case TRAP:
+      case MIPS_TRAP:
         switch (addr & 0xf)
         {
           case NEWLINE:
@@ -489,13 +472,13 @@ static void Interpret (uint32_t start)
         }
         break;
 
-      case LW:
+      case MIPS_LW:
         RREAD (EXE1, rs);
         reg [rt] = LoadWord (reg [rs] + simm);
         RWRITE (WB, rt);
         break;
 
-      case SW:
+      case MIPS_SW:
         RREAD (EXE1, rs);
         RREAD (MEM1, rt);
         StoreWord (reg [rt], reg [rs] + simm);
@@ -514,6 +497,8 @@ static void Interpret (uint32_t start)
   }
 
 halt:
+  mips_interval_close (&interval_log, count);
+  mips_regions_finish (&regions);
   printf ("\n"
           "cycles = %"PR_INTEGER"\n"
           "bubbles = %"PR_INTEGER"\n"
@@ -526,11 +511,34 @@ halt:
 int main(int argc, char *argv[])
 {
   uint32_t c, start;
-  int little_endian;
+  int little_endian, opt, log_every = 100000;
+  const char *log_file = NULL;
+  const char *usage = "usage: %s [-r regions] [-o log [-n instructions]] executable\n";
   FILE *f;
 
   printf("CS3339 MIPS Interpreter\n");
-  if (argc != 2) {fprintf(stderr, "usage: %s executable\n", argv[0]); exit(-1);}
+  mips_regions_none(&regions);
+  mips_interval_none(&interval_log);
+  while ((opt = getopt(argc, argv, "r:o:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        mips_regions_load(&regions, optarg);
+        break;
+      case 'o':
+        log_file = optarg;
+        break;
+      case 'n':
+        log_every = atoi(optarg);
+        if (log_every < 0) log_every = 0;
+        break;
+      default:
+        fprintf(stderr, usage, argv[0]);
+        exit(-1);
+    }
+  }
+  if (argc - optind != 1) {fprintf(stderr, usage, argv[0]); exit(-1);}
+  argv += optind - 1;
+  if (log_file != NULL) mips_interval_open(&interval_log, log_file, log_every);
   if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
   if (sizeof(long long) != 8) {fprintf(stderr, "error: need 8-byte long longs\n"); exit(-1);}
 
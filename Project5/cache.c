@@ -1,5 +1,7 @@
 /* -*- c-basic-offset: 2; tab-width: 2; eval: (c-set-offset 'case-label '+) -*- */
 
+#define _POSIX_C_SOURCE 200809L
+
 #if __STDC_VERSION__ < 199901L
 # warning "This program should be compiled as C99 or better"
 #endif
@@ -12,6 +14,11 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <unistd.h>
+
+#include "../common/mips.h"
+#include "../common/regions.h"
+#include "../common/interval.h"
 
 typedef intmax_t integer;
 #define PR_INTEGER PRIiMAX
@@ -79,6 +86,12 @@ static integer stores       = 0;
 static integer store_misses = 0;
 static integer write_backs  = 0;
 
+// Only the regions given with -r go through the cache; see common/regions.h
+static struct mips_regions regions;
+
+// -o log [-n instructions]: interval rows, see common/interval.h
+static struct mips_interval interval_log;
+
 
 
 enum {
@@ -300,33 +313,6 @@ static void StoreWord(uint32_t data, uint32_t addr)
 
 
 
-enum opcode {
-	FUNCTION = 0x00,
-	J        = 0x02,
-	JAL      = 0x03,
-	BEQ      = 0x04,
-	BNE      = 0x05,
-	ADDIU    = 0x09,
-	ANDI     = 0x0C,
-	LUI      = 0x0F,
-	TRAP     = 0x1A,
-	LW       = 0x23,
-	SW       = 0x2B
-};
-
-enum funcode {
-	SLL  = 0x00,
-	SRA  = 0x03,
-	JR   = 0x08,
-	MFHI = 0x10,
-	MFLO = 0x12,
-	MULT = 0x18,
-	DIV  = 0x1A,
-	ADDU = 0x21,
-	SUBU = 0x23,
-	SLT  = 0x2a
-};
-
 enum trapcode {
 	NEWLINE = 0x00,
 	PRINT   = 0x01,
@@ -388,115 +374,105 @@ static void Interpret (uint32_t start)
 	/// Begin program execution
 	while (1) {
 		uint32_t instr = Fetch (pc);
+		const bool detailed = mips_regions_at (&regions, count);
+		mips_interval_at (&interval_log, count);
 		reg [ZERO] = 0;
 		pc += 4;
 		++count;
 
-		uint8_t  opcode = bitrange (instr, 26, 32);
-		uint8_t  rs     = bitrange (instr, 21, 26);
-		uint8_t  rt     = bitrange (instr, 16, 21);
-		uint8_t  rd     = bitrange (instr, 11, 16);
-		uint8_t  shamt  = bitrange (instr, 6, 11);
-		uint8_t  funct  = bitrange (instr, 0, 6);
-		uint16_t uimm   = bitrange (instr, 0, 16);
-		int16_t  simm   = sign_extend (uimm, 16);
-		uint32_t addr   = bitrange (instr, 0, 26);
-		uint32_t jaddr  = (pc & 0xf0000000) + addr * 4;
-		uint32_t baddr  = pc + simm * 4;
-
-		switch (opcode)
-		{
-		case FUNCTION:
-			switch (funct)
-			{
-			case SLL:
-				reg [rd] = reg [rs] << shamt;
-				break;
+		const struct mips_insn in = mips_decode (instr, pc - 4);
+		uint8_t  rs     = in.rs;
+		uint8_t  rt     = in.rt;
+		uint8_t  rd     = in.rd;
+		uint8_t  shamt  = in.shamt;
+		uint16_t uimm   = in.uimm;
+		int16_t  simm   = in.simm;
+		uint32_t addr   = in.addr;
 
-			case SRA:
-				reg [rd] = sign_extend (reg [rs] >> shamt, 32 - shamt);
-				break;
+		switch (in.op)
+		{
+		case MIPS_SLL:
+			reg [rd] = reg [rs] << shamt;
+			break;
 
-			case JR:
-				pc = reg [rs];
-				break;
+		case MIPS_SRA:
+			reg [rd] = sign_extend (reg [rs] >> shamt, 32 - shamt);
+			break;
 
-			case MFHI:
-				reg [rd] = hi;
-				break;
+		case MIPS_JR:
+			pc = reg [rs];
+			break;
 
-			case MFLO:
-				reg [rd] = lo;
-				break;
+		case MIPS_MFHI:
+			reg [rd] = hi;
+			break;
 
-			case MULT:
-				; // C requires a statement after a label
-				uint64_t wide = reg [rs] * reg [rt];
-				lo = wide & 0xffffffff;
-				hi = wide >> 32;
-				break;
+		case MIPS_MFLO:
+			reg [rd] = lo;
+			break;
 
-			case DIV:
-				if (reg [rt] == 0) {
-					fprintf (stderr, "division by zero: pc = 0x%"PRIx32"\n", pc - 4);
-					goto halt;
-				}
-				else {
-					lo = reg [rs] / reg [rt];
-					hi = reg [rs] % reg [rt];
-				}
-				break;
+		case MIPS_MULT:
+			; // C requires a statement after a label
+			uint64_t wide = reg [rs] * reg [rt];
+			lo = wide & 0xffffffff;
+			hi = wide >> 32;
+			break;
 
-			case ADDU:
-				reg [rd] = reg [rs] + reg [rt];
-				break;
+		case MIPS_DIV:
+			if (reg [rt] == 0) {
+				fprintf (stderr, "division by zero: pc = 0x%"PRIx32"\n", pc - 4);
+				goto halt;
+			}
+			else {
+				lo = reg [rs] / reg [rt];
+				hi = reg [rs] % reg [rt];
+			}
+			break;
 
-			case SUBU:
-				reg [rd] = reg [rs] - reg [rt];
-				break;
+		case MIPS_ADDU:
+			reg [rd] = reg [rs] + reg [rt];
+			break;
 
-			case SLT:
-				reg [rd] = ((int32_t) reg [rs] < (int32_t) reg [rt] ? 1 : 0);
-				break;
+		case MIPS_SUBU:
+			reg [rd] = reg [rs] - reg [rt];
+			break;
 
-			default:
-				fprintf (stderr, "unimplemented instruction: pc = 0x%"PRIx32"\n", pc - 4);
-				goto halt;
-			}
+		case MIPS_SLT:
+			reg [rd] = ((int32_t) reg [rs] < (int32_t) reg [rt] ? 1 : 0);
 			break;
 
-		case J:
-			pc = jaddr;
+		case MIPS_J:
+			pc = in.target;
 			break;
 
-		case JAL:
+		case MIPS_JAL:
 			reg [RA] = pc;
-			pc = jaddr;
+			pc = in.target;
 			break;
 
-		case BEQ:
+		case MIPS_BEQ:
 			if (reg [rs] == reg [rt])
-				pc = baddr;
+				pc = in.target;
 			break;
 
-		case BNE:
+		case MIPS_BNE:
 			if (reg [rs] != reg [rt])
-				pc = baddr;
+				pc = in.target;
 			break;
 
-		case ADDIU:
+		case MIPS_ADDIU:
 			reg [rt] = reg [rs] + simm;
 			break;
 
-		case ANDI:
+		case MIPS_ANDI:
 			reg [rt] = reg [rs] & uimm;
 			break;
 
-		case LUI:
+		case MIPS_LUI:
 			reg [rt] = (uint32_t)uimm << 16;
 			break;
 
-		case TRAP:
+		case MIPS_TRAP:
 			switch (addr & 0xf)
 			{
 			case NEWLINE:
@@ -524,13 +500,15 @@ static void Interpret (uint32_t start)
 			}
 			break;
 
-		case LW:
-			CLOAD (reg [rs] + simm);
+		case MIPS_LW:
+			if (detailed)
+				CLOAD (reg [rs] + simm);
 			reg [rt] = LoadWord (reg [rs] + simm);
 			break;
 
-		case SW:
-			CSTORE (reg [rs] + simm);
+		case MIPS_SW:
+			if (detailed)
+				CSTORE (reg [rs] + simm);
 			StoreWord (reg [rt], reg [rs] + simm);
 			break;
 
@@ -541,6 +519,8 @@ static void Interpret (uint32_t start)
 	}
 
 halt:
+	mips_interval_close (&interval_log, count);
+	mips_regions_finish (&regions);
 	finalize_cache ();
 
 	printf ("\nprogram finished at pc = 0x%"PRIx32"  (%"PR_INTEGER" instructions executed)\n", pc, count);
@@ -572,13 +552,49 @@ halt:
 int main(int argc, char *argv[])
 {
 	uint32_t c, start;
-	int little_endian;
+	int little_endian, opt, log_every = 100000;
+	const char *log_file = NULL, *region_file = NULL;
+	const char *usage = "usage: %s [-r regions] [-o log [-n instructions]] executable\n";
 	FILE *f;
 
 	INITIALIZE_GLOBAL_DATA ();
 
 	printf("CS3339 MIPS Interpreter\n");
-	if (argc != 2) {fprintf(stderr, "usage: %s executable\n", argv[0]); exit(-1);}
+	mips_regions_none(&regions);
+	mips_interval_none(&interval_log);
+	while ((opt = getopt(argc, argv, "r:o:n:")) != -1) {
+		switch (opt) {
+			case 'r':
+				region_file = optarg;
+				break;
+			case 'o':
+				log_file = optarg;
+				break;
+			case 'n':
+				log_every = atoi(optarg);
+				if (log_every < 0) log_every = 0;
+				break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				exit(-1);
+		}
+	}
+	if (argc - optind != 1) {fprintf(stderr, usage, argv[0]); exit(-1);}
+	argv += optind - 1;
+	if (region_file != NULL) {
+		mips_regions_load(&regions, region_file);
+		mips_regions_counter(&regions, &loads);
+		mips_regions_counter(&regions, &load_misses);
+		mips_regions_counter(&regions, &stores);
+		mips_regions_counter(&regions, &store_misses);
+		mips_regions_counter(&regions, &write_backs);
+	}
+	if (log_file != NULL) mips_interval_open(&interval_log, log_file, log_every);
+	mips_interval_column(&interval_log, "lw", &loads);
+	mips_interval_column(&interval_log, "load_misses", &load_misses);
+	mips_interval_column(&interval_log, "sw", &stores);
+	mips_interval_column(&interval_log, "store_misses", &store_misses);
+	mips_interval_column(&interval_log, "write_backs", &write_backs);
 	if (sizeof(int) != 4) {fprintf(stderr, "error: need 4-byte integers\n"); exit(-1);}
 	if (sizeof(long long) != 8) {fprintf(stderr, "error: need 8-byte long longs\n"); exit(-1);}
 
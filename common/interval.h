@@ -0,0 +1,155 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+#ifndef MIPS_INTERVAL_H
+#define MIPS_INTERVAL_H
+
+/* Interval logs. A simulator registers the counters it already keeps and,
+ * every `every' instructions, a row of how much each one grew is appended to
+ * a binary log. The file is a header, the column names, then fixed-width
+ * rows of int64_t in host byte order:
+ *
+ *   "MIPSIVL1" | uint64_t every | uint32_t columns | uint32_t 0
+ *   char name [MIPS_INTERVAL_NAME] x columns
+ *   int64_t instructions, delta [columns]   x rows
+ *
+ * where `instructions' is the count at the end of the row's interval; the
+ * last row may be short. tools/intervalcsv turns a log into CSV.
+ *
+ *   static struct mips_interval log;
+ *
+ *   mips_interval_open (&log, "sssp.ivl", 100000);
+ *   mips_interval_column (&log, "loads", &loads);
+ *   ...
+ *   mips_interval_at (&log, count);    after each instruction
+ *   ...
+ *   mips_interval_close (&log, count);
+ *
+ * Rows are collected in a buffer and written a block at a time. Without a
+ * log (mips_interval_none) the per-instruction cost is still one compare. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MIPS_INTERVAL_MAGIC "MIPSIVL1"
+#define MIPS_INTERVAL_COLUMNS 16
+#define MIPS_INTERVAL_NAME 16
+#define MIPS_INTERVAL_ROWS 4096  // buffered before each write
+
+struct mips_interval_header {
+  char magic [8];
+  uint64_t every;
+  uint32_t columns, pad;
+};
+
+struct mips_interval {
+  FILE *f;
+  const char *path;
+  uint64_t every, next, last;   // last: the count at the latest row
+  int columns, rows, started;
+  char name [MIPS_INTERVAL_COLUMNS][MIPS_INTERVAL_NAME];
+  intmax_t *counter [MIPS_INTERVAL_COLUMNS];
+  intmax_t snap [MIPS_INTERVAL_COLUMNS];
+  int64_t *buffer;              // [MIPS_INTERVAL_ROWS][columns + 1]
+};
+
+static inline
+void mips_interval_none (struct mips_interval *iv)
+{
+  memset (iv, 0, sizeof (*iv));
+  iv->next = UINT64_MAX;
+}
+
+static inline
+void mips_interval_open (struct mips_interval *iv, const char *path, uint64_t every)
+/* Starts a log; exits on errors, as the simulators do */
+{
+  mips_interval_none (iv);
+  if (every == 0) {fprintf (stderr, "error: interval must be positive\n"); exit (-1);}
+  iv->f = fopen (path, "wb");
+  if (iv->f == NULL) {fprintf (stderr, "error: could not open file %s\n", path); exit (-1);}
+  iv->path = path;
+  iv->every = iv->next = every;
+}
+
+static inline
+void mips_interval_column (struct mips_interval *iv, const char *name, intmax_t *counter)
+/* Registers a counter; call before the first row */
+{
+  if (iv->columns == MIPS_INTERVAL_COLUMNS) {fprintf (stderr, "error: too many interval columns\n"); exit (-1);}
+  strncpy (iv->name [iv->columns], name, MIPS_INTERVAL_NAME - 1);
+  iv->snap [iv->columns] = *counter;
+  iv->counter [iv->columns++] = counter;
+}
+
+static inline
+void mips_interval_flush (struct mips_interval *iv)
+{
+  struct mips_interval_header h;
+
+  if (!iv->started) {
+    memcpy (h.magic, MIPS_INTERVAL_MAGIC, sizeof (h.magic));
+    h.every = iv->every;
+    h.columns = iv->columns;
+    h.pad = 0;
+    if (fwrite (&h, sizeof (h), 1, iv->f) != 1 ||
+        fwrite (iv->name, MIPS_INTERVAL_NAME, iv->columns, iv->f) != (size_t) iv->columns)
+      goto error;
+    iv->started = 1;
+  }
+  if (fwrite (iv->buffer, (iv->columns + 1) * sizeof (int64_t), iv->rows, iv->f) != (size_t) iv->rows)
+    goto error;
+  iv->rows = 0;
+  return;
+error:
+  fprintf (stderr, "error: could not write %s\n", iv->path);
+  exit (-1);
+}
+
+static inline
+void mips_interval_row (struct mips_interval *iv, uint64_t n)
+/* Appends the growth of every counter since the last row */
+{
+  int64_t *row;
+  int k;
+
+  if (iv->buffer == NULL) {
+    iv->buffer = (int64_t *) malloc (MIPS_INTERVAL_ROWS * (iv->columns + 1) * sizeof (int64_t));
+    if (iv->buffer == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  }
+  row = iv->buffer + iv->rows * (iv->columns + 1);
+  row [0] = n;
+  for (k = 0; k < iv->columns; k++) {
+    row [k + 1] = *iv->counter [k] - iv->snap [k];
+    iv->snap [k] = *iv->counter [k];
+  }
+  iv->last = n;
+  iv->next = n + iv->every;
+  if (++iv->rows == MIPS_INTERVAL_ROWS)
+    mips_interval_flush (iv);
+}
+
+static inline
+void mips_interval_at (struct mips_interval *iv, uint64_t n)
+/* Call with the number of instructions executed so far */
+{
+  if (n == iv->next)
+    mips_interval_row (iv, n);
+}
+
+static inline
+void mips_interval_close (struct mips_interval *iv, uint64_t n)
+/* Writes the last, partial row and closes the log */
+{
+  if (iv->f == NULL)
+    return;
+  if (n > iv->last || iv->buffer == NULL)
+    mips_interval_row (iv, n);
+  mips_interval_flush (iv);
+  if (fclose (iv->f) != 0) {fprintf (stderr, "error: could not write %s\n", iv->path); exit (-1);}
+  free (iv->buffer);
+  mips_interval_none (iv);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+#ifndef MIPS_BATCH_H
+#define MIPS_BATCH_H
+
+/* Decoding eight instructions at a time. mips_decode8 splits eight words into
+ * structure-of-arrays field vectors, sign-extending the immediate and
+ * computing jump and branch targets on the way. Built with -mavx2 it does the
+ * field extraction with AVX2 shifts and masks; otherwise the same loop is
+ * written out in scalar code. The op id is looked up per lane either way,
+ * since the opcode/funct table is too sparse to be worth a gather. */
+
+#include "mips.h"
+
+#ifdef __AVX2__
+# include <immintrin.h>
+#endif
+
+struct mips_batch {
+  uint32_t word [8];
+  uint32_t pc [8];
+  uint32_t opcode [8], rs [8], rt [8], rd [8], shamt [8], funct [8];
+  uint32_t uimm [8];
+  int32_t  simm [8];
+  uint32_t addr [8];
+  uint32_t target [8];
+  uint8_t  op [8];
+};
+
+static inline
+void mips_decode8 (struct mips_batch *b, const uint32_t *words, uint32_t pc)
+/* Decodes words[0..7], the first at address pc. The words are in host
+   order. */
+{
+  int i;
+
+#ifdef __AVX2__
+  const __m256i lane = _mm256_setr_epi32 (0, 4, 8, 12, 16, 20, 24, 28);
+  const __m256i five = _mm256_set1_epi32 (0x1f);
+  const __m256i six = _mm256_set1_epi32 (0x3f);
+  __m256i w = _mm256_loadu_si256 ((const __m256i *) words);
+  __m256i p = _mm256_add_epi32 (_mm256_set1_epi32 ((int32_t) pc), lane);
+  __m256i next = _mm256_add_epi32 (p, _mm256_set1_epi32 (4));
+  __m256i opcode = _mm256_srli_epi32 (w, 26);
+  __m256i uimm = _mm256_and_si256 (w, _mm256_set1_epi32 (0xffff));
+  __m256i simm = _mm256_srai_epi32 (_mm256_slli_epi32 (w, 16), 16);
+  __m256i addr = _mm256_and_si256 (w, _mm256_set1_epi32 (0x3ffffff));
+  __m256i jump = _mm256_add_epi32 (_mm256_and_si256 (next, _mm256_set1_epi32 ((int32_t) 0xf0000000)),
+                                   _mm256_slli_epi32 (addr, 2));
+  __m256i branch = _mm256_add_epi32 (next, _mm256_slli_epi32 (simm, 2));
+  // j and jal are opcodes 2 and 3: (opcode & ~1) == 2
+  __m256i is_jump = _mm256_cmpeq_epi32 (_mm256_andnot_si256 (_mm256_set1_epi32 (1), opcode),
+                                        _mm256_set1_epi32 (2));
+
+  _mm256_storeu_si256 ((__m256i *) b->word, w);
+  _mm256_storeu_si256 ((__m256i *) b->pc, p);
+  _mm256_storeu_si256 ((__m256i *) b->opcode, opcode);
+  _mm256_storeu_si256 ((__m256i *) b->rs, _mm256_and_si256 (_mm256_srli_epi32 (w, 21), five));
+  _mm256_storeu_si256 ((__m256i *) b->rt, _mm256_and_si256 (_mm256_srli_epi32 (w, 16), five));
+  _mm256_storeu_si256 ((__m256i *) b->rd, _mm256_and_si256 (_mm256_srli_epi32 (w, 11), five));
+  _mm256_storeu_si256 ((__m256i *) b->shamt, _mm256_and_si256 (_mm256_srli_epi32 (w, 6), five));
+  _mm256_storeu_si256 ((__m256i *) b->funct, _mm256_and_si256 (w, six));
+  _mm256_storeu_si256 ((__m256i *) b->uimm, uimm);
+  _mm256_storeu_si256 ((__m256i *) b->simm, simm);
+  _mm256_storeu_si256 ((__m256i *) b->addr, addr);
+  _mm256_storeu_si256 ((__m256i *) b->target, _mm256_blendv_epi8 (branch, jump, is_jump));
+#else
+  for (i = 0; i < 8; i++) {
+    uint32_t word = words [i];
+
+    b->word [i]   = word;
+    b->pc [i]     = pc + 4 * i;
+    b->opcode [i] = word >> 26;
+    b->rs [i]     = (word >> 21) & 0x1f;
+    b->rt [i]     = (word >> 16) & 0x1f;
+    b->rd [i]     = (word >> 11) & 0x1f;
+    b->shamt [i]  = (word >> 6) & 0x1f;
+    b->funct [i]  = word & 0x3f;
+    b->uimm [i]   = word & 0xffff;
+    b->simm [i]   = (int16_t) b->uimm [i];
+    b->addr [i]   = word & 0x3ffffff;
+    if ((b->opcode [i] & ~1u) == 2)
+      b->target [i] = ((b->pc [i] + 4) & 0xf0000000) + (b->addr [i] << 2);
+    else
+      b->target [i] = b->pc [i] + 4 + ((uint32_t) b->simm [i] << 2);
+  }
+#endif
+
+  for (i = 0; i < 8; i++)
+    b->op [i] = mips_lookup (b->opcode [i], b->funct [i]);
+}
+
+static inline
+struct mips_insn mips_batch_insn (const struct mips_batch *b, int i)
+/* Lane i as a mips_decode record */
+{
+  struct mips_insn in;
+
+  in.word   = b->word [i];
+  in.pc     = b->pc [i];
+  in.op     = b->op [i];
+  in.opcode = b->opcode [i];
+  in.funct  = b->funct [i];
+  in.rs     = b->rs [i];
+  in.rt     = b->rt [i];
+  in.rd     = b->rd [i];
+  in.shamt  = b->shamt [i];
+  in.uimm   = b->uimm [i];
+  in.simm   = b->simm [i];
+  in.addr   = b->addr [i];
+  in.target = b->target [i];
+  return in;
+}
+
+#endif
@@ -0,0 +1,227 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+#ifndef MIPS_ITER_H
+#define MIPS_ITER_H
+
+/* Structured access to a MIPS executable without parsing disassembly text.
+ * mips_open maps the file read-only; a mips_iter then walks any range of its
+ * instructions and yields a decoded struct mips_insn per step. Nothing is
+ * allocated on the heap: the program and the iterator are plain structs owned
+ * by the caller, and the words are read straight from the mapping.
+ *
+ *   struct mips_program prog;
+ *   struct mips_iter it;
+ *   struct mips_insn in;
+ *
+ *   if (mips_open (&prog, "sssp.mips") != 0) ...
+ *   mips_iter_init (&it, &prog, 0, prog.count);
+ *   while (mips_iter_next (&it, &in))
+ *     ... in.pc, in.op, in.rs, in.rt, in.rd, in.simm, in.target ...
+ *   mips_close (&prog);
+ *
+ * mips_record is a fixed-size binary form of the raw fields for tools that
+ * would rather read a stream than link the decoder; mips_emit_json writes one
+ * instruction as a line of JSON with only the operands its format has. */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mips.h"
+
+struct mips_program {
+  void *map;
+  size_t size;
+  uint32_t count;              // instructions
+  uint32_t start;              // address of the first instruction
+  const unsigned char *text;   // big-endian words, as in the file
+};
+
+struct mips_iter {
+  const unsigned char *text;
+  uint32_t start, index, end;
+};
+
+static inline
+uint32_t mips_word (const unsigned char *text, uint32_t index)
+{
+  const unsigned char *b = text + 4 * (size_t) index;
+
+  return (uint32_t) b [0] << 24 | (uint32_t) b [1] << 16 | (uint32_t) b [2] << 8 | b [3];
+}
+
+static inline
+int mips_map (struct mips_program *p, int fd)
+/* Maps an open executable. Returns 0, or -1 if fd is not a regular file or
+   is too short for the count in its header. */
+{
+  struct stat st;
+  const unsigned char *h;
+
+  p->map = NULL;
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size < 8)
+    return -1;
+  p->size = st.st_size;
+  p->map = mmap (NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p->map == MAP_FAILED) {
+    p->map = NULL;
+    return -1;
+  }
+  h = (const unsigned char *) p->map;
+  p->count = mips_word (h, 0);
+  p->start = mips_word (h, 1);
+  p->text = h + 8;
+  if ((uint64_t) p->count * 4 > p->size - 8) {
+    munmap (p->map, p->size);
+    p->map = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static inline
+int mips_open (struct mips_program *p, const char *path)
+{
+  int fd = open (path, O_RDONLY), r;
+
+  if (fd < 0)
+    return -1;
+  r = mips_map (p, fd);
+  close (fd);
+  return r;
+}
+
+static inline
+void mips_close (struct mips_program *p)
+{
+  if (p->map != NULL)
+    munmap (p->map, p->size);
+  p->map = NULL;
+}
+
+static inline
+void mips_iter_init (struct mips_iter *it, const struct mips_program *p, uint32_t first, uint32_t end)
+/* Iterates over instructions [first, end), clamped to the program */
+{
+  it->text = p->text;
+  it->start = p->start;
+  it->end = end < p->count ? end : p->count;
+  it->index = first < it->end ? first : it->end;
+}
+
+static inline
+int mips_iter_next (struct mips_iter *it, struct mips_insn *in)
+{
+  if (it->index >= it->end)
+    return 0;
+  *in = mips_decode (mips_word (it->text, it->index), it->start + 4 * it->index);
+  it->index++;
+  return 1;
+}
+
+/* Binary records: 24 bytes per instruction in host byte order. The register
+ * and shamt fields are raw, whatever the instruction; mips_desc [op].format
+ * says which of them are operands. `imm' is the sign-extended immediate, or
+ * the 26-bit field for j, jal and trap, and `target' is 0 but for jumps and
+ * branches. */
+struct mips_record {
+  uint32_t pc;
+  uint32_t word;
+  uint32_t target;
+  int32_t  imm;
+  uint8_t  op, rs, rt, rd, shamt;
+  uint8_t  pad [3];
+};
+
+static inline
+struct mips_record mips_record (const struct mips_insn *in)
+{
+  struct mips_record r;
+  uint8_t format = mips_desc [in->op].format;
+
+  memset (&r, 0, sizeof (r));
+  r.pc = in->pc;
+  r.word = in->word;
+  r.target = format == MIPS_FMT_JUMP || format == MIPS_FMT_BRANCH ? in->target : 0;
+  r.imm = format == MIPS_FMT_JUMP || format == MIPS_FMT_CODE ? (int32_t) in->addr :
+          format == MIPS_FMT_UIMM ? (int32_t) in->uimm : in->simm;
+  r.op = in->op;
+  r.rs = in->rs;
+  r.rt = in->rt;
+  r.rd = in->rd;
+  r.shamt = in->shamt;
+  return r;
+}
+
+#define MIPS_JSON_MAX 160
+
+// The JSON fields of each format, in the order they are written
+enum {
+  MIPS_JSON_RS = 1, MIPS_JSON_RT = 2, MIPS_JSON_RD = 4, MIPS_JSON_SHAMT = 8,
+  MIPS_JSON_IMM = 16, MIPS_JSON_TARGET = 32
+};
+
+static const uint8_t mips_json_fields [] = {
+  [MIPS_FMT_NONE]   = 0,
+  [MIPS_FMT_R3]     = MIPS_JSON_RS | MIPS_JSON_RT | MIPS_JSON_RD,
+  [MIPS_FMT_SHIFT]  = MIPS_JSON_RS | MIPS_JSON_RD | MIPS_JSON_SHAMT,
+  [MIPS_FMT_RS]     = MIPS_JSON_RS,
+  [MIPS_FMT_RD]     = MIPS_JSON_RD,
+  [MIPS_FMT_RSRT]   = MIPS_JSON_RS | MIPS_JSON_RT,
+  [MIPS_FMT_JUMP]   = MIPS_JSON_TARGET,
+  [MIPS_FMT_BRANCH] = MIPS_JSON_RS | MIPS_JSON_RT | MIPS_JSON_TARGET,
+  [MIPS_FMT_SIMM]   = MIPS_JSON_RS | MIPS_JSON_RT | MIPS_JSON_IMM,
+  [MIPS_FMT_UIMM]   = MIPS_JSON_RS | MIPS_JSON_RT | MIPS_JSON_IMM,
+  [MIPS_FMT_UPPER]  = MIPS_JSON_RT | MIPS_JSON_IMM,
+  [MIPS_FMT_CODE]   = MIPS_JSON_IMM,
+  [MIPS_FMT_MEM]    = MIPS_JSON_RS | MIPS_JSON_RT | MIPS_JSON_IMM
+};
+
+static inline
+char *mips_put_u32 (char *p, uint32_t v)
+{
+  char tmp [10], *q = tmp + sizeof (tmp);
+
+  do {
+    *--q = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  memcpy (p, q, tmp + sizeof (tmp) - q);
+  return p + (tmp + sizeof (tmp) - q);
+}
+
+static inline
+char *mips_emit_json (char *p, const struct mips_insn *in)
+/* {"pc":4194304,"word":...,"op":"addiu","rs":29,"rt":29,"imm":-8} and a
+   newline, at most MIPS_JSON_MAX bytes. Only the operands of the op's format
+   are written, always in the order rs, rt, rd, shamt, imm, target. Numbers
+   are decimal. */
+{
+  struct mips_record r = mips_record (in);
+  uint8_t fields = mips_json_fields [mips_desc [r.op].format];
+
+  #define FIELD(NAME) (memcpy (p, NAME, sizeof (NAME) - 1), p += sizeof (NAME) - 1)
+  FIELD ("{\"pc\":");    p = mips_put_u32 (p, r.pc);
+  FIELD (",\"word\":");  p = mips_put_u32 (p, r.word);
+  FIELD (",\"op\":\"");  memcpy (p, mips_mnemonic [r.op], 16); p += mips_mnemonic_len [r.op];
+  *p++ = '"';
+  if (fields & MIPS_JSON_RS)    {FIELD (",\"rs\":");    p = mips_put_u32 (p, r.rs);}
+  if (fields & MIPS_JSON_RT)    {FIELD (",\"rt\":");    p = mips_put_u32 (p, r.rt);}
+  if (fields & MIPS_JSON_RD)    {FIELD (",\"rd\":");    p = mips_put_u32 (p, r.rd);}
+  if (fields & MIPS_JSON_SHAMT) {FIELD (",\"shamt\":"); p = mips_put_u32 (p, r.shamt);}
+  if (fields & MIPS_JSON_IMM) {
+    FIELD (",\"imm\":");
+    if (r.imm < 0) {
+      *p++ = '-';
+      p = mips_put_u32 (p, - (uint32_t) r.imm);
+    } else
+      p = mips_put_u32 (p, r.imm);
+  }
+  if (fields & MIPS_JSON_TARGET) {FIELD (",\"target\":"); p = mips_put_u32 (p, r.target);}
+  FIELD ("}\n");
+  #undef FIELD
+  return p;
+}
+
+#endif
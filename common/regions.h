@@ -0,0 +1,170 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+#ifndef MIPS_REGIONS_H
+#define MIPS_REGIONS_H
+
+/* Sampled simulation. A region list, as written by Project3's stats -i,
+ * names the stretches of a run that stand for the whole of it:
+ *
+ *   # comments
+ *   instructions 449513
+ *   20000 30000 0.25
+ *   ...
+ *
+ * Each region is [start, end) in instructions executed before, with the
+ * share of the run it represents. A simulator runs everything functionally
+ * and does its detailed work only inside regions; the counters it registers
+ * are then rescaled so that its usual report reads as an estimate for the
+ * whole run.
+ *
+ *   static struct mips_regions regions;
+ *
+ *   mips_regions_load (&regions, "sssp.regions");
+ *   mips_regions_counter (&regions, &misses);
+ *   ...
+ *   if (mips_regions_at (&regions, count)) ... detailed work ...
+ *   ...
+ *   mips_regions_finish (&regions);
+ *
+ * Without a list every instruction is detailed and nothing is rescaled. The
+ * per-instruction cost is one compare. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define MIPS_REGIONS_COUNTERS 16
+
+struct mips_region {
+  uint64_t start, end;
+  double scale;  // instructions represented per instruction simulated
+};
+
+struct mips_regions {
+  struct mips_region *region;
+  int n, i;
+  uint64_t next;      // where detail next switches on or off
+  int detailed;
+  int counters;
+  intmax_t *counter [MIPS_REGIONS_COUNTERS];
+  intmax_t snap [MIPS_REGIONS_COUNTERS];
+  double kept [MIPS_REGIONS_COUNTERS];
+};
+
+static inline
+void mips_regions_none (struct mips_regions *r)
+{
+  r->region = NULL;
+  r->n = r->i = 0;
+  r->next = UINT64_MAX;
+  r->detailed = 1;
+  r->counters = 0;
+}
+
+static inline
+int mips_regions_by_start (const void *a, const void *b)
+{
+  const struct mips_region *x = (const struct mips_region *) a, *y = (const struct mips_region *) b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static inline
+void mips_regions_load (struct mips_regions *r, const char *file)
+/* Reads a region list; exits on errors, as the simulators do */
+{
+  char line [256];
+  unsigned long long start, end, total = 0;
+  double weight;
+  int capacity = 0, k;
+  FILE *f = fopen (file, "r");
+
+  mips_regions_none (r);
+  if (f == NULL) {fprintf (stderr, "error: could not open file %s\n", file); exit (-1);}
+  while (fgets (line, sizeof (line), f) != NULL) {
+    if (line [0] == '#' || line [0] == '\n') continue;
+    if (sscanf (line, "instructions %llu", &total) == 1) continue;
+    if (sscanf (line, "%llu %llu %lf", &start, &end, &weight) != 3 || end <= start || total == 0) {
+      fprintf (stderr, "error: bad region list %s\n", file);
+      exit (-1);
+    }
+    if (r->n == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      r->region = (struct mips_region *) realloc (r->region, capacity * sizeof (*r->region));
+      if (r->region == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+    }
+    r->region [r->n].start = start;
+    r->region [r->n].end = end;
+    r->region [r->n].scale = weight * total / (end - start);
+    r->n++;
+  }
+  fclose (f);
+  if (r->n == 0) {fprintf (stderr, "error: no regions in %s\n", file); exit (-1);}
+  qsort (r->region, r->n, sizeof (*r->region), mips_regions_by_start);
+  for (k = 1; k < r->n; k++) {
+    if (r->region [k].start < r->region [k - 1].end) {fprintf (stderr, "error: overlapping regions in %s\n", file); exit (-1);}
+  }
+  r->detailed = 0;
+  r->next = r->region [0].start;
+}
+
+static inline
+void mips_regions_counter (struct mips_regions *r, intmax_t *counter)
+/* Registers a counter of detailed events, to be rescaled */
+{
+  if (r->counters == MIPS_REGIONS_COUNTERS) {fprintf (stderr, "error: too many region counters\n"); exit (-1);}
+  r->kept [r->counters] = 0;
+  r->counter [r->counters++] = counter;
+}
+
+static inline
+void mips_regions_switch (struct mips_regions *r, uint64_t n)
+{
+  int k;
+
+  while (n == r->next) {
+    if (r->detailed) {
+      // Leaving region i: keep what it counted, scaled up
+      for (k = 0; k < r->counters; k++) {
+        r->kept [k] += (*r->counter [k] - r->snap [k]) * r->region [r->i].scale;
+      }
+      r->detailed = 0;
+      r->i++;
+      r->next = r->i < r->n ? r->region [r->i].start : UINT64_MAX;
+    } else {
+      for (k = 0; k < r->counters; k++) {
+        r->snap [k] = *r->counter [k];
+      }
+      r->detailed = 1;
+      r->next = r->region [r->i].end;
+    }
+  }
+}
+
+static inline
+int mips_regions_at (struct mips_regions *r, uint64_t n)
+/* Whether the instruction after the first n is simulated in detail */
+{
+  if (n == r->next)
+    mips_regions_switch (r, n);
+  return r->detailed;
+}
+
+static inline
+void mips_regions_finish (struct mips_regions *r)
+/* Replaces each counter with its estimate for the whole run */
+{
+  int k;
+
+  if (r->region == NULL)
+    return;
+  if (r->detailed)
+    mips_regions_switch (r, r->next);
+  for (k = 0; k < r->counters; k++) {
+    *r->counter [k] = (intmax_t) (r->kept [k] + 0.5);
+  }
+  free (r->region);
+  r->region = NULL;
+}
+
+#endif
@@ -0,0 +1,205 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+/* Decode microbenchmark. Times three ways of splitting instruction words into
+ * fields over the same buffer, and checks that they agree:
+ *
+ *   macro   the BITRANGE/SIGN_EXTEND expressions the disassembler used to
+ *           inline into Decode
+ *   scalar  mips_decode, one record per word
+ *   batch   mips_decode8, eight words per call (AVX2 when built with -mavx2)
+ *
+ * usage: decodebench [-n words] [-r rounds] [program.mips]
+ *
+ * With a program the words are its text, repeated to fill the buffer;
+ * otherwise they are random. Build with e.g.
+ *   cc -std=c99 -O2 -mavx2 decodebench.c -o decodebench */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/mips_batch.h"
+
+#ifndef CHAR_BIT
+# define CHAR_BIT 8
+#endif
+
+// Reinterpret the bit sequence defined by [low, high) on `instr'
+#define BITRANGE(value, low, high) (((value) >> low) & ((1 << (high - low)) - 1))
+#define SIGN_EXTEND(value, bits) (((signed int) (value) << (sizeof (int) * CHAR_BIT - bits)) >> (sizeof (int) * CHAR_BIT - bits))
+
+static double Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t Convert (uint32_t x)
+{
+  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+static void Load (const char *name, uint32_t *words, int n)
+{
+  uint32_t header [2], *text;
+  int c, count;
+  FILE *f = fopen (name, "rb");
+
+  if (f == NULL || fread (header, 4, 2, f) != 2) {fprintf (stderr, "error: could not read %s\n", name); exit (-1);}
+  count = Convert (header [0]);
+  if (count <= 0) {fprintf (stderr, "error: %s has no instructions\n", name); exit (-1);}
+  text = (uint32_t *) malloc (count * 4);
+  if (text == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  if (fread (text, 4, count, f) != (size_t) count) {fprintf (stderr, "error: could not read %s\n", name); exit (-1);}
+  fclose (f);
+  for (c = 0; c < n; c++)
+    words [c] = Convert (text [c % count]);
+  free (text);
+}
+
+// Folding every field into a checksum keeps the compiler from dropping work.
+// The fold is a plain sum so that it does not serialise the loop.
+#define FOLD(sum, opcode, rs, rt, rd, shamt, funct, uimm, simm, addr, target) \
+  ((sum) += (opcode) ^ ((rs) << 6) ^ ((rt) << 11) ^ ((rd) << 16) ^ ((shamt) << 21) ^ \
+            ((funct) << 26) ^ (uimm) ^ (uint32_t) (simm) ^ (addr) ^ (target))
+
+static uint32_t Macro (const uint32_t *words, int n)
+{
+  uint32_t sum = 0;
+  int c;
+
+  for (c = 0; c < n; c++) {
+    unsigned int instr  = words [c];
+    unsigned int pc     = 0x00400000 + c * 4;
+    unsigned int opcode = BITRANGE (instr, 26, 32);
+    unsigned int rs     = BITRANGE (instr, 21, 26);
+    unsigned int rt     = BITRANGE (instr, 16, 21);
+    unsigned int rd     = BITRANGE (instr, 11, 16);
+    unsigned int shamt  = BITRANGE (instr, 6, 11);
+    unsigned int funct  = BITRANGE (instr, 0, 6);
+    unsigned int imm    = BITRANGE (instr, 0, 16);
+    signed   int simm   = SIGN_EXTEND (imm, 16);
+    unsigned int addr   = BITRANGE (instr, 0, 26);
+    unsigned int jaddr  = ((pc + 4) & 0xf0000000) + (addr << 2);
+    unsigned int baddr  = pc + ((unsigned) simm << 2) + 4;
+
+    FOLD (sum, opcode, rs, rt, rd, shamt, funct, imm, simm, addr, (opcode & ~1u) == 2 ? jaddr : baddr);
+  }
+  return sum;
+}
+
+static uint32_t Scalar (const uint32_t *words, int n)
+{
+  uint32_t sum = 0;
+  int c;
+
+  for (c = 0; c < n; c++) {
+    struct mips_insn in = mips_decode (words [c], 0x00400000 + c * 4);
+    FOLD (sum, in.opcode, in.rs, in.rt, in.rd, in.shamt, in.funct, in.uimm, in.simm, in.addr, in.target);
+  }
+  return sum;
+}
+
+static uint32_t Batch (const uint32_t *words, int n)
+{
+  struct mips_batch b;
+  uint32_t sum = 0;
+  int c, i;
+
+  for (c = 0; c + 8 <= n; c += 8) {
+    mips_decode8 (&b, words + c, 0x00400000 + c * 4);
+    for (i = 0; i < 8; i++)
+      FOLD (sum, b.opcode [i], b.rs [i], b.rt [i], b.rd [i], b.shamt [i], b.funct [i],
+            b.uimm [i], b.simm [i], b.addr [i], b.target [i]);
+  }
+  for (; c < n; c++) {
+    struct mips_insn in = mips_decode (words [c], 0x00400000 + c * 4);
+    FOLD (sum, in.opcode, in.rs, in.rt, in.rd, in.shamt, in.funct, in.uimm, in.simm, in.addr, in.target);
+  }
+  return sum;
+}
+
+static void Check (const uint32_t *words, int n)
+/* Every lane of the batch decoder must match mips_decode, field for field */
+{
+  struct mips_batch b;
+  struct mips_insn a, in;
+  int c, i;
+
+  for (c = 0; c + 8 <= n; c += 8) {
+    mips_decode8 (&b, words + c, 0x00400000 + c * 4);
+    for (i = 0; i < 8; i++) {
+      a = mips_batch_insn (&b, i);
+      in = mips_decode (words [c + i], 0x00400000 + (c + i) * 4);
+      if (a.word != in.word || a.pc != in.pc || a.op != in.op || a.opcode != in.opcode ||
+          a.funct != in.funct || a.rs != in.rs || a.rt != in.rt || a.rd != in.rd ||
+          a.shamt != in.shamt || a.uimm != in.uimm || a.simm != in.simm ||
+          a.addr != in.addr || a.target != in.target) {
+        fprintf (stderr, "error: batch decode of %08x at %x disagrees\n", in.word, in.pc);
+        exit (-1);
+      }
+    }
+  }
+}
+
+int main (int argc, char *argv [])
+{
+  static const char *name [] = {"macro", "scalar", "batch"};
+  uint32_t (*const run [])(const uint32_t *, int) = {Macro, Scalar, Batch};
+  uint32_t *words, sum [3];
+  int c, k, n = 1 << 22, rounds = 10;
+  double t, best [3];
+
+  while ((c = getopt (argc, argv, "n:r:")) != -1) {
+    switch (c) {
+      case 'n': n = atoi (optarg); break;
+      case 'r': rounds = atoi (optarg); break;
+      default:
+        fprintf (stderr, "usage: %s [-n words] [-r rounds] [program.mips]\n", argv [0]);
+        exit (-1);
+    }
+  }
+  if (n < 8 || rounds < 1 || argc - optind > 1) {
+    fprintf (stderr, "usage: %s [-n words] [-r rounds] [program.mips]\n", argv [0]);
+    exit (-1);
+  }
+
+  words = (uint32_t *) malloc (n * sizeof (*words));
+  if (words == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  if (optind < argc)
+    Load (argv [optind], words, n);
+  else {
+    srand (3339);
+    for (c = 0; c < n; c++)
+      words [c] = ((uint32_t) rand () << 16) ^ (uint32_t) rand ();
+  }
+  Check (words, n);
+
+#ifdef __AVX2__
+  printf ("batch decoder: AVX2\n");
+#else
+  printf ("batch decoder: scalar fallback\n");
+#endif
+  for (k = 0; k < 3; k++) {
+    best [k] = 1e9;
+    for (c = 0; c < rounds; c++) {
+      t = Now ();
+      sum [k] = run [k] (words, n);
+      t = Now () - t;
+      if (t < best [k]) best [k] = t;
+    }
+    printf ("%-6s %6.2f ns/word  %7.1f Mwords/s  (checksum %08x)\n",
+            name [k], best [k] * 1e9 / n, n / best [k] * 1e-6, sum [k]);
+  }
+  if (sum [0] != sum [1] || sum [1] != sum [2]) {fprintf (stderr, "error: checksums differ\n"); exit (-1);}
+
+  free (words);
+  return 0;
+}
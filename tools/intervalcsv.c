@@ -0,0 +1,58 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+/* Interval log to CSV. Reads a log written by a simulator's -o option (see
+ * common/interval.h) and prints one line per row, headed by the column names:
+ *
+ *   instructions,R-type,I-type,...
+ *   100000,33512,66488,...
+ *
+ * usage: intervalcsv [log]      (standard input without one)
+ *
+ * Build with e.g.
+ *   cc -std=c99 -O2 intervalcsv.c -o intervalcsv */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../common/interval.h"
+
+int main (int argc, char *argv [])
+{
+  struct mips_interval_header h;
+  char name [MIPS_INTERVAL_NAME + 1];
+  int64_t *row;
+  uint32_t k;
+  FILE *f = stdin;
+
+  if (argc > 2) {fprintf (stderr, "usage: %s [log]\n", argv [0]); exit (-1);}
+  if (argc == 2 && (f = fopen (argv [1], "rb")) == NULL) {fprintf (stderr, "error: could not open file %s\n", argv [1]); exit (-1);}
+  if (fread (&h, sizeof (h), 1, f) != 1 || memcmp (h.magic, MIPS_INTERVAL_MAGIC, sizeof (h.magic)) != 0 ||
+      h.columns > MIPS_INTERVAL_COLUMNS) {
+    fprintf (stderr, "error: %s is not an interval log\n", argc == 2 ? argv [1] : "input");
+    exit (-1);
+  }
+
+  printf ("instructions");
+  name [MIPS_INTERVAL_NAME] = '\0';
+  for (k = 0; k < h.columns; k++) {
+    if (fread (name, MIPS_INTERVAL_NAME, 1, f) != 1) {fprintf (stderr, "error: truncated interval log\n"); exit (-1);}
+    printf (",%s", name);
+  }
+  printf ("\n");
+
+  row = (int64_t *) malloc ((h.columns + 1) * sizeof (int64_t));
+  if (row == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  while (fread (row, sizeof (int64_t), h.columns + 1, f) == h.columns + 1) {
+    printf ("%"PRId64, row [0]);
+    for (k = 0; k < h.columns; k++)
+      printf (",%"PRId64, row [k + 1]);
+    printf ("\n");
+  }
+  if (ferror (f) || !feof (f)) {fprintf (stderr, "error: truncated interval log\n"); exit (-1);}
+
+  free (row);
+  return 0;
+}
@@ -0,0 +1,390 @@
+/* -*- c-basic-offset: 2; tab-width: 2; indent-tabs-mode: nil; eval: (c-set-offset 'case-label '+) -*- */
+
+/* Synthetic workload generator. Writes a .mips executable that runs a loop of
+ * randomly generated basic blocks until it has executed about the requested
+ * number of instructions, then stops with trap 0xa. Only instructions that
+ * the interpreter and the simulators implement are used.
+ *
+ * usage: workload [options] output.mips
+ *
+ *   -s seed       generator seed; the same options and seed give the same
+ *                 program (default 1)
+ *   -n count      dynamic instructions, with an optional k, M or G suffix
+ *                 (default 1M)
+ *   -m mix        relative weights of alu, mul, load and store operations,
+ *                 e.g. alu:50,mul:5,load:30,store:15 (the default)
+ *   -b min:max    operations per basic block, uniform (default 4:12)
+ *   -k blocks     basic blocks in the loop body (default 64)
+ *   -t percent    chance that a block's branch is taken (default 50)
+ *   -f bytes      data footprint, a power of two from 1k up to the 1M of data
+ *                 memory the simulators have (default 64k)
+ *   -p pattern    stream, stride, chase or random (default stream)
+ *   -S bytes      stride for stride, node spacing for chase (default 64)
+ *
+ * Every block ends with a conditional branch that is taken with the given
+ * probability, decided by a linear congruential generator in registers; a
+ * taken branch skips a short shadow block. Address generation for loads and
+ * stores, and the branch decision, are instructions of their own, so the
+ * mix weights operations rather than instructions. The data area is
+ * [0x10000000, 0x10000000 + footprint); chase first links one node every
+ * -S bytes into a single pseudo-random cycle.
+ *
+ * Build with e.g. cc -std=c99 -O2 workload.c -o workload */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../common/mips.h"
+
+// Register roles. The block bodies only ever write $t0-$t7.
+enum {
+  T0 = 8,       // $t0-$t7: data
+  PTR = 16,     // $s0: chase pointer, or stream/stride offset
+  CENTER = 17,  // $s1: middle of the data area
+  ADDR = 18,    // $s2: random address state
+  MUL = 19,     // $s3: LCG multiplier
+  LIMIT = 20,   // $s4: branch threshold
+  COIN = 21,    // $s5: branch decision state
+  STEP = 22,    // $s6: stream/stride step
+  COUNT = 23,   // $s7: iterations left
+  TMP = 24,     // $t8
+  FLAG = 25     // $t9
+};
+
+enum {STREAM, STRIDE, CHASE, RANDOM};
+
+#define LCG_A 1103515245
+#define LCG_C 12345
+#define START 0x00400000
+#define DATA  0x10000000
+
+static uint32_t *text;
+static int count, capacity;
+
+static uint64_t seed;
+
+static uint32_t Random (void)
+/* xorshift64*, so that programs do not depend on the C library's rand */
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return (seed * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static int Between (int lo, int hi)
+{
+  return lo + Random () % (hi - lo + 1);
+}
+
+static int Emit (uint32_t word)
+{
+  if (count == capacity) {
+    capacity = capacity ? 2 * capacity : 4096;
+    text = (uint32_t *) realloc (text, capacity * sizeof (*text));
+    if (text == NULL) {fprintf (stderr, "error: out of memory\n"); exit (-1);}
+  }
+  text [count] = word;
+  return count++;
+}
+
+static int R (int op, int rd, int rs, int rt, int shamt)
+{
+  return Emit ((uint32_t) mips_desc [op].opcode << 26 | rs << 21 | rt << 16 | rd << 11 | shamt << 6 | mips_desc [op].funct);
+}
+
+static int I (int op, int rt, int rs, int imm)
+{
+  return Emit ((uint32_t) mips_desc [op].opcode << 26 | rs << 21 | rt << 16 | (imm & 0xffff));
+}
+
+static void Branch (int at, int target)
+/* Points the branch at index `at' to index `target' */
+{
+  int offset = target - at - 1;
+
+  if (offset < -32768 || offset > 32767) {fprintf (stderr, "error: loop too large for a branch\n"); exit (-1);}
+  text [at] = (text [at] & 0xffff0000) | (offset & 0xffff);
+}
+
+static void Constant (int reg, uint32_t value)
+{
+  I (MIPS_LUI, reg, 0, (value + 0x8000) >> 16);
+  I (MIPS_ADDIU, reg, reg, value & 0xffff);
+}
+
+static int Log2 (uint32_t x)
+{
+  int n = 0;
+
+  while ((1u << n) < x) n++;
+  return (1u << n) == x ? n : -1;
+}
+
+static void Next (int reg)
+/* reg = reg * LCG_A + LCG_C */
+{
+  R (MIPS_MULT, 0, reg, MUL, 0);
+  R (MIPS_MFLO, reg, 0, 0, 0);
+  I (MIPS_ADDIU, reg, reg, LCG_C);
+}
+
+static void Scale (int dst, int src, int bits, int align)
+/* dst = CENTER + (the top `bits' bits of src, signed) << align. Offsets are
+   kept in the top bits of a register so that they wrap for free, since the
+   ISA has no and with a register operand. */
+{
+  R (MIPS_SRA, dst, src, 0, 32 - bits);
+  if (align > 0) R (MIPS_SLL, dst, dst, 0, align);
+  R (MIPS_ADDU, dst, dst, CENTER, 0);
+}
+
+static int pattern, footprint_bits, stride_bits;
+
+static void Address (void)
+/* Leaves the next data address in TMP */
+{
+  switch (pattern) {
+    case STREAM:
+    case STRIDE:
+      R (MIPS_ADDU, PTR, PTR, STEP, 0);
+      Scale (TMP, PTR, footprint_bits, 0);
+      break;
+    case RANDOM:
+      Next (ADDR);
+      Scale (TMP, ADDR, footprint_bits - 2, 2);
+      break;
+  }
+}
+
+static int Reg (void)
+{
+  return T0 + Random () % 8;
+}
+
+static void Alu (void)
+{
+  switch (Random () % 8) {
+    case 0: R (MIPS_ADDU, Reg (), Reg (), Reg (), 0); break;
+    case 1: R (MIPS_SUBU, Reg (), Reg (), Reg (), 0); break;
+    case 2: R (MIPS_SLT, Reg (), Reg (), Reg (), 0); break;
+    case 3: R (MIPS_SLL, Reg (), Reg (), 0, Between (1, 31)); break;
+    case 4: R (MIPS_SRA, Reg (), Reg (), 0, Between (1, 31)); break;
+    case 5: I (MIPS_ANDI, Reg (), Reg (), Random ()); break;
+    case 6: I (MIPS_LUI, Reg (), 0, Random ()); break;
+    default: I (MIPS_ADDIU, Reg (), Reg (), Random ()); break;
+  }
+}
+
+static void Mul (void)
+{
+  if (Random () % 2) {
+    R (MIPS_MULT, 0, Reg (), Reg (), 0);
+  } else {
+    // Divide by 1..256 so that the divisor is never zero
+    I (MIPS_ANDI, FLAG, Reg (), 0xff);
+    I (MIPS_ADDIU, FLAG, FLAG, 1);
+    R (MIPS_DIV, 0, Reg (), FLAG, 0);
+  }
+  R (Random () % 2 ? MIPS_MFLO : MIPS_MFHI, Reg (), 0, 0, 0);
+}
+
+static void Load (void)
+{
+  if (pattern == CHASE) {
+    I (MIPS_LW, PTR, PTR, 0);
+    return;
+  }
+  Address ();
+  I (MIPS_LW, Reg (), TMP, 0);
+}
+
+static void Store (void)
+{
+  if (pattern == CHASE) {
+    I (MIPS_SW, Reg (), PTR, 4);  // beside the link, which stays intact
+    return;
+  }
+  Address ();
+  I (MIPS_SW, Reg (), TMP, 0);
+}
+
+static int Chain (int bits)
+/* Links the 2^bits nodes into one cycle: node i points to node
+   (a * i + c) mod 2^bits, a full-period sequence for odd c and a = 1 mod 4.
+   The index lives in PTR; only its low bits matter. Returns the length of
+   the linking loop. */
+{
+  int loop, at;
+  uint32_t a = (Random () & ~3u) | 1, c = (Random () & 0x7ffe) | 1;
+
+  Constant (TMP, a);
+  Constant (FLAG, 1u << bits);
+  I (MIPS_ADDIU, PTR, 0, 0);
+  loop = R (MIPS_MULT, 0, PTR, TMP, 0);
+  R (MIPS_MFLO, T0, 0, 0, 0);
+  I (MIPS_ADDIU, T0, T0, c);
+  R (MIPS_SLL, T0 + 1, PTR, 0, 32 - bits);
+  Scale (T0 + 1, T0 + 1, bits, stride_bits);
+  R (MIPS_SLL, T0 + 2, T0, 0, 32 - bits);
+  Scale (T0 + 2, T0 + 2, bits, stride_bits);
+  I (MIPS_SW, T0 + 2, T0 + 1, 0);
+  R (MIPS_ADDU, PTR, T0, 0, 0);
+  I (MIPS_ADDIU, FLAG, FLAG, -1);
+  at = I (MIPS_BNE, 0, FLAG, 0);
+  Branch (at, loop);
+  R (MIPS_ADDU, PTR, CENTER, 0, 0);  // node 0
+  return at - loop + 1;
+}
+
+static uint64_t Size (const char *s)
+/* A count with an optional k, M or G (binary) suffix */
+{
+  char *end;
+  uint64_t n = strtoull (s, &end, 10);
+
+  switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+  }
+  if (end == s || *end != '\0') {fprintf (stderr, "error: bad size %s\n", s); exit (-1);}
+  return n;
+}
+
+static void Put (FILE *f, uint32_t word)
+{
+  unsigned char b [4] = {word >> 24, word >> 16, word >> 8, word};
+
+  if (fwrite (b, 1, 4, f) != 4) {fprintf (stderr, "error: could not write output\n"); exit (-1);}
+}
+
+int main (int argc, char *argv [])
+{
+  static const char *usage = "usage: %s [-s seed] [-n count] [-m mix] [-b min:max] [-k blocks] [-t percent] [-f bytes] [-p stream|stride|chase|random] [-S bytes] output.mips\n";
+  static const char *kinds [4] = {"alu", "mul", "load", "store"};
+  int weight [4] = {50, 5, 30, 15}, total, lo = 4, hi = 12, blocks = 64, taken = 50;
+  uint64_t instructions = 1 << 20, footprint = 64 << 10, stride = 64, iterations, init;
+  int c, k, n, loop, at, skip, ops, link = 0;
+  double shadow = 0;
+  char *p, *end;
+  FILE *f;
+
+  seed = 1;
+  pattern = STREAM;
+  while ((c = getopt (argc, argv, "s:n:m:b:k:t:f:p:S:")) != -1) {
+    switch (c) {
+      case 's': seed = strtoull (optarg, NULL, 0); break;
+      case 'n': instructions = Size (optarg); break;
+      case 'm':
+        memset (weight, 0, sizeof (weight));
+        for (p = strtok (optarg, ","); p != NULL; p = strtok (NULL, ",")) {
+          for (k = 0; k < 4; k++) {
+            n = strlen (kinds [k]);
+            if (strncmp (p, kinds [k], n) == 0 && p [n] == ':') break;
+          }
+          if (k == 4) {fprintf (stderr, "error: bad mix %s\n", p); exit (-1);}
+          weight [k] = strtol (p + n + 1, &end, 10);
+          if (*end != '\0' || weight [k] < 0) {fprintf (stderr, "error: bad mix %s\n", p); exit (-1);}
+        }
+        break;
+      case 'b':
+        lo = strtol (optarg, &end, 10);
+        hi = *end == ':' ? atoi (end + 1) : lo;
+        break;
+      case 'k': blocks = atoi (optarg); break;
+      case 't': taken = atoi (optarg); break;
+      case 'f': footprint = Size (optarg); break;
+      case 'p':
+        if (strcmp (optarg, "stream") == 0) pattern = STREAM;
+        else if (strcmp (optarg, "stride") == 0) pattern = STRIDE;
+        else if (strcmp (optarg, "chase") == 0) pattern = CHASE;
+        else if (strcmp (optarg, "random") == 0) pattern = RANDOM;
+        else {fprintf (stderr, usage, argv [0]); exit (-1);}
+        break;
+      case 'S': stride = Size (optarg); break;
+      default:
+        fprintf (stderr, usage, argv [0]);
+        exit (-1);
+    }
+  }
+  if (argc - optind != 1) {fprintf (stderr, usage, argv [0]); exit (-1);}
+  total = weight [0] + weight [1] + weight [2] + weight [3];
+  if (total <= 0) {fprintf (stderr, "error: the mix is empty\n"); exit (-1);}
+  if (lo < 1 || hi < lo) {fprintf (stderr, "error: bad block size %d:%d\n", lo, hi); exit (-1);}
+  if (blocks < 1) {fprintf (stderr, "error: need at least one block\n"); exit (-1);}
+  if (taken < 0 || taken > 100) {fprintf (stderr, "error: the taken percentage must be 0-100\n"); exit (-1);}
+  footprint_bits = footprint <= 0xffffffff ? Log2 (footprint) : -1;
+  if (footprint_bits < 10 || footprint_bits > 20) {fprintf (stderr, "error: the footprint must be a power of two from 1k to 1M\n"); exit (-1);}
+  stride_bits = stride <= footprint ? Log2 (stride) : -1;
+  if (pattern == STRIDE && (stride % 4 != 0 || stride >= footprint)) {fprintf (stderr, "error: the stride must be a multiple of 4 below the footprint\n"); exit (-1);}
+  if (pattern == CHASE && (stride_bits < 3 || stride_bits >= footprint_bits)) {fprintf (stderr, "error: chase needs a power-of-two spacing of at least 8, below the footprint\n"); exit (-1);}
+  if (pattern == STREAM) stride = 4;
+  if (seed == 0) seed = 1;
+
+  // Set up: constants, the data registers, and the chain for chase
+  Constant (MUL, LCG_A);
+  Constant (CENTER, DATA + (uint32_t) footprint / 2);
+  Constant (COIN, Random ());
+  Constant (ADDR, Random ());
+  Constant (LIMIT, (taken * 256 + 50) / 100 - 128);
+  Constant (STEP, (uint32_t) stride << (32 - footprint_bits));
+  R (MIPS_ADDU, PTR, 0, 0, 0);
+  if (pattern == CHASE) link = Chain (footprint_bits - stride_bits);
+  for (k = 0; k < 8; k++) {
+    Constant (T0 + k, Random ());
+  }
+  init = count + ((uint64_t) link << (footprint_bits - stride_bits));
+
+  // The loop: blocks, each ending in a branch over a shadow block
+  at = I (MIPS_LUI, COUNT, 0, 0);
+  I (MIPS_ADDIU, COUNT, COUNT, 0);
+  loop = count;
+  for (k = 0; k < blocks; k++) {
+    ops = Between (lo, hi);
+    for (n = 0; n < ops; n++) {
+      c = Random () % total;
+      if (c < weight [0]) Alu ();
+      else if (c < weight [0] + weight [1]) Mul ();
+      else if (c < weight [0] + weight [1] + weight [2]) Load ();
+      else Store ();
+    }
+    Next (COIN);
+    R (MIPS_SRA, FLAG, COIN, 0, 24);
+    R (MIPS_SLT, FLAG, FLAG, LIMIT, 0);
+    skip = I (MIPS_BNE, 0, FLAG, 0);
+    ops = Between (1, 3);
+    for (n = 0; n < ops; n++) {
+      Alu ();
+    }
+    Branch (skip, count);
+    shadow += ops * taken / 100.0;
+  }
+  I (MIPS_ADDIU, COUNT, COUNT, -1);
+  Branch (I (MIPS_BNE, 0, COUNT, 0), loop);
+  Emit ((uint32_t) mips_desc [MIPS_TRAP].opcode << 26 | 0xa);
+
+  // Size the trip count to the requested number of instructions
+  iterations = instructions > init ? (uint64_t) ((instructions - init) / (count - loop - shadow) + 0.5) : 0;
+  if (iterations < 1) iterations = 1;
+  if (iterations > 0xffffffff) {fprintf (stderr, "error: too many instructions for one loop; use more blocks\n"); exit (-1);}
+  text [at] |= ((iterations + 0x8000) >> 16) & 0xffff;
+  text [at + 1] |= iterations & 0xffff;
+
+  f = fopen (argv [optind], "wb");
+  if (f == NULL) {fprintf (stderr, "error: could not open file %s\n", argv [optind]); exit (-1);}
+  Put (f, count);
+  Put (f, START);
+  for (k = 0; k < count; k++) {
+    Put (f, text [k]);
+  }
+  if (fclose (f) != 0) {fprintf (stderr, "error: could not write output\n"); exit (-1);}
+  printf ("%s: %d instructions, %llu iterations, about %.0f executed\n", argv [optind], count,
+          (unsigned long long) iterations, init + iterations * (count - loop - shadow));
+  return 0;
+}